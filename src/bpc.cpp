@@ -0,0 +1,233 @@
+#include "bpc.hh"
+
+#include <profile.hh>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace tnp {
+
+namespace {
+
+const char bpc_magic[8] = {'T', 'N', 'P', 'B', 'P', 'C', 0, 0};
+
+size_t array_count(uint32_t flags)
+{
+    return 3 + (flags & bpc_normals ? 3 : 0) + (flags & bpc_colors ? 3 : 0) + (flags & bpc_labels ? 1 : 0);
+}
+
+bool little_endian()
+{
+    const uint32_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+} // namespace
+
+BpcHeader bpc_header(uint64_t count, uint32_t flags)
+{
+    BpcHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, bpc_magic, sizeof(bpc_magic));
+    header.version = bpc_version;
+    header.flags = flags;
+    header.count = count;
+    return header;
+}
+
+bool MappedCloud::open(const std::string &filename)
+{
+    count_ = 0;
+    stride_ = 0;
+    flags_ = 0;
+    if(not little_endian())
+    {
+        std::cout << "Error: "
+            << "bpc files are little endian, '"
+            << filename
+            << "' cannot be mapped on this platform"
+            << std::endl;
+        return false;
+    }
+    if(not file_.open(filename))
+    {
+        std::cout << "Error: "
+            << "failed to open input bpc file '"
+            << filename
+            << "', file not found, nothing loaded"
+            << std::endl;
+        return false;
+    }
+    BpcHeader header;
+    if(file_.size() < sizeof(BpcHeader))
+    {
+        std::cout << "Error: "
+            << "input bpc file '"
+            << filename
+            << "' is too small to hold a header"
+            << std::endl;
+        file_.close();
+        return false;
+    }
+    std::memcpy(&header, file_.data(), sizeof(BpcHeader));
+    if(std::memcmp(header.magic, bpc_magic, sizeof(bpc_magic)) != 0 or header.version != bpc_version)
+    {
+        std::cout << "Error: "
+            << "input file '"
+            << filename
+            << "' is not a version "
+            << bpc_version
+            << " bpc file"
+            << std::endl;
+        file_.close();
+        return false;
+    }
+    // the count is bounded by the file size before any product, so a crafted one cannot overflow
+    const size_t arrays = array_count(header.flags);
+    const size_t body = file_.size() - sizeof(BpcHeader);
+    const size_t stride = bpc_array_stride(header.count);
+    if(header.count > body / (4 * arrays) or body < arrays * stride)
+    {
+        std::cout << "Error: "
+            << "input bpc file '"
+            << filename
+            << "' is truncated, "
+            << header.count
+            << " points expected"
+            << std::endl;
+        file_.close();
+        return false;
+    }
+    count_ = static_cast<size_t>(header.count);
+    stride_ = stride;
+    flags_ = header.flags;
+    return true;
+}
+
+bool load_bpc(const std::string &filename, PointCloud &cloud)
+{
+    TNP_SCOPE("load_bpc");
+    cloud.clear();
+    MappedCloud mapped(filename);
+    if(not mapped.is_open())
+        return false;
+    if(mapped.size() == 0)
+    {
+        std::cout << "Error: "
+            << "no points read from input bpc file '"
+            << filename
+            << "'"
+            << std::endl;
+        return false;
+    }
+    const size_t n = mapped.size();
+    if(mapped.has_normals()) cloud.add_normals();
+    if(mapped.has_colors()) cloud.add_colors();
+    if(mapped.has_labels()) cloud.add_labels();
+    cloud.resize(n);
+    std::copy(mapped.x(), mapped.x() + n, cloud.x().data());
+    std::copy(mapped.y(), mapped.y() + n, cloud.y().data());
+    std::copy(mapped.z(), mapped.z() + n, cloud.z().data());
+    if(mapped.has_normals())
+    {
+        std::copy(mapped.nx(), mapped.nx() + n, cloud.nx().data());
+        std::copy(mapped.ny(), mapped.ny() + n, cloud.ny().data());
+        std::copy(mapped.nz(), mapped.nz() + n, cloud.nz().data());
+    }
+    if(mapped.has_colors())
+    {
+        std::copy(mapped.r(), mapped.r() + n, cloud.r().data());
+        std::copy(mapped.g(), mapped.g() + n, cloud.g().data());
+        std::copy(mapped.b(), mapped.b() + n, cloud.b().data());
+    }
+    if(mapped.has_labels())
+        std::copy(mapped.labels(), mapped.labels() + n, cloud.labels().data());
+
+    std::cout << "Loaded "
+        << n
+        << " points from bpc file '" << filename << "'";
+    if(mapped.has_normals() and mapped.has_colors())
+        std::cout << " (with normals and colors)";
+    else if(mapped.has_normals())
+        std::cout << " (with normals)";
+    else if(mapped.has_colors())
+        std::cout << " (with colors)";
+    if(mapped.has_labels())
+        std::cout << " (with labels)";
+    std::cout << std::endl;
+    return true;
+}
+
+bool save_bpc(const std::string &filename, const PointCloud &cloud)
+{
+    TNP_SCOPE("save_bpc");
+    if(not little_endian())
+    {
+        std::cout << "Error: "
+            << "bpc files are little endian, '"
+            << filename
+            << "' cannot be written on this platform"
+            << std::endl;
+        return false;
+    }
+    std::ofstream fs(filename, std::ios::binary);
+    if(not fs.is_open())
+    {
+        std::cout << "Error: "
+            << "failed to open output bpc file '"
+            << filename
+            << "', nothing saved"
+            << std::endl;
+        return false;
+    }
+
+    const BpcHeader header = bpc_header(cloud.size(), (cloud.has_normals() ? bpc_normals : 0)
+        | (cloud.has_colors() ? bpc_colors : 0)
+        | (cloud.has_labels() ? bpc_labels : 0));
+    fs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const size_t bytes = cloud.size() * 4;
+    const char padding[64] = {};
+    auto write_array = [&](const void* data)
+    {
+        fs.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+        fs.write(padding, static_cast<std::streamsize>(bpc_array_stride(header.count) - bytes));
+    };
+    write_array(cloud.x().data());
+    write_array(cloud.y().data());
+    write_array(cloud.z().data());
+    if(cloud.has_normals())
+    {
+        write_array(cloud.nx().data());
+        write_array(cloud.ny().data());
+        write_array(cloud.nz().data());
+    }
+    if(cloud.has_colors())
+    {
+        write_array(cloud.r().data());
+        write_array(cloud.g().data());
+        write_array(cloud.b().data());
+    }
+    if(cloud.has_labels())
+        write_array(cloud.labels().data());
+    if(not fs)
+    {
+        std::cout << "Error: "
+            << "failed to write output bpc file '"
+            << filename
+            << "'"
+            << std::endl;
+        return false;
+    }
+
+    std::cout << "Saved "
+        << cloud.size()
+        << " points to bpc file '" << filename << "'" << std::endl;
+    return true;
+}
+
+} // namespace tnp
@@ -0,0 +1,81 @@
+#pragma once
+#include <mapped_file.hh>
+#include <point_cloud.hh>
+
+#include <cstdint>
+#include <string>
+
+namespace tnp {
+
+// Binary point cloud (.bpc): a 64 byte header followed by the structure-of-arrays buffers of a
+// PointCloud, in the order x y z [nx ny nz] [r g b] [labels], each starting on a 64 byte boundary.
+// Values are stored little endian, as float32 and int32.
+struct BpcHeader {
+    char magic[8];      // "TNPBPC" followed by two zero bytes
+    uint32_t version;   // bpc_version
+    uint32_t flags;     // bpc_normals | bpc_colors | bpc_labels
+    uint64_t count;     // number of points
+    uint8_t reserved[40];
+};
+static_assert(sizeof(BpcHeader) == 64, "the bpc header is 64 bytes");
+
+constexpr uint32_t bpc_version = 1;
+constexpr uint32_t bpc_normals = 1u << 0;
+constexpr uint32_t bpc_colors = 1u << 1;
+constexpr uint32_t bpc_labels = 1u << 2;
+
+// Bytes taken by one array of `count` values, padded so the next array stays 64 byte aligned,
+// 0 when they would not fit in a size_t
+inline size_t bpc_array_stride(uint64_t count)
+{
+    if(count > (SIZE_MAX - 63) / 4)
+        return 0;
+    return (static_cast<size_t>(count) * 4 + 63) & ~size_t(63);
+}
+// Header of a file holding `count` points and the attributes in `flags`
+BpcHeader bpc_header(uint64_t count, uint32_t flags);
+
+// Read-only bpc file mapped in memory, opening it only validates the header so the arrays
+// are available in O(1) and paged in on first access
+class MappedCloud {
+public:
+    MappedCloud() = default;
+    explicit MappedCloud(const std::string &filename) { open(filename); }
+
+    bool open(const std::string &filename);
+    bool is_open() const { return file_.is_open(); }
+
+    size_t size() const { return count_; }
+    bool has_normals() const { return flags_ & bpc_normals; }
+    bool has_colors() const { return flags_ & bpc_colors; }
+    bool has_labels() const { return flags_ & bpc_labels; }
+
+    // Arrays of size() values, null when the attribute is absent
+    const float *x() const { return array<float>(0); }
+    const float *y() const { return array<float>(1); }
+    const float *z() const { return array<float>(2); }
+    const float *nx() const { return has_normals() ? array<float>(3) : nullptr; }
+    const float *ny() const { return has_normals() ? array<float>(4) : nullptr; }
+    const float *nz() const { return has_normals() ? array<float>(5) : nullptr; }
+    const float *r() const { return has_colors() ? array<float>(color_slot()) : nullptr; }
+    const float *g() const { return has_colors() ? array<float>(color_slot() + 1) : nullptr; }
+    const float *b() const { return has_colors() ? array<float>(color_slot() + 2) : nullptr; }
+    const int32_t *labels() const { return has_labels() ? array<int32_t>(color_slot() + (has_colors() ? 3 : 0)) : nullptr; }
+
+private:
+    size_t color_slot() const { return has_normals() ? 6 : 3; }
+    template<typename T>
+    const T *array(size_t slot) const { return reinterpret_cast<const T *>(file_.data() + sizeof(BpcHeader) + slot * stride_); }
+
+    MappedFile file_;
+    size_t count_ = 0;
+    size_t stride_ = 0;
+    uint32_t flags_ = 0;
+};
+
+// Copies a bpc file into the cloud, the arrays are copied without any parsing
+bool load_bpc(const std::string &filename, PointCloud &cloud);
+
+bool save_bpc(const std::string &filename, const PointCloud &cloud);
+
+} // namespace tnp
@@ -0,0 +1,63 @@
+#include "cloud_io.hh"
+
+#include <bpc.hh>
+#include <obj.h>
+#include <ply.hh>
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+namespace tnp {
+
+namespace {
+
+void unknown_format(const std::string &filename)
+{
+    std::cout << "Error: "
+        << "unknown point cloud format for '"
+        << filename
+        << "', .obj, .ply or .bpc expected"
+        << std::endl;
+}
+
+} // namespace
+
+std::string file_extension(const std::string &filename)
+{
+    const size_t dot = filename.find_last_of('.');
+    const size_t slash = filename.find_last_of("/\\");
+    if(dot == std::string::npos or (slash != std::string::npos and dot < slash))
+        return {};
+    std::string ext = filename.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+
+bool load_cloud(const std::string &filename, PointCloud &cloud)
+{
+    const std::string ext = file_extension(filename);
+    if(ext == "obj")
+        return load_obj(filename, cloud);
+    if(ext == "ply")
+        return load_ply(filename, cloud);
+    if(ext == "bpc")
+        return load_bpc(filename, cloud);
+    unknown_format(filename);
+    return false;
+}
+
+bool save_cloud(const std::string &filename, const PointCloud &cloud)
+{
+    const std::string ext = file_extension(filename);
+    if(ext == "obj")
+        return save_obj(filename, cloud);
+    if(ext == "ply")
+        return save_ply(filename, cloud);
+    if(ext == "bpc")
+        return save_bpc(filename, cloud);
+    unknown_format(filename);
+    return false;
+}
+
+} // namespace tnp
@@ -0,0 +1,15 @@
+#pragma once
+#include <point_cloud.hh>
+
+#include <string>
+
+namespace tnp {
+
+// Loads or saves a cloud in the format given by the file extension: .obj, .ply (binary little endian) or .bpc
+bool load_cloud(const std::string &filename, PointCloud &cloud);
+bool save_cloud(const std::string &filename, const PointCloud &cloud);
+
+// Lower case extension of the file name without the dot, empty when there is none
+std::string file_extension(const std::string &filename);
+
+} // namespace tnp
@@ -0,0 +1,377 @@
+#include "cloud_stream.hh"
+
+#include <cloud_io.hh>
+#include <obj_tokens.hh>
+#include <ply.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace tnp {
+
+namespace {
+
+constexpr size_t stream_buffer_size = size_t(1) << 22;
+
+void obj_warning(const std::string &filename, size_t line, const std::string &message)
+{
+    std::cout << "Warning: "
+        << "failed to read line "
+        << line
+        << " of input obj file '"
+        << filename
+        << "', "
+        << message
+        << ", line skipped"
+        << std::endl;
+}
+
+// Parses up to 6 values after the keyword, false when one of them is not a number
+bool parse_values(const char *it, const char *end, float (&values)[6], size_t &count)
+{
+    count = 0;
+    bool valid = true;
+    for(std::string_view token = next_token(it, end); not token.empty(); token = next_token(it, end), ++count)
+    {
+        if(count < 6 and valid and not parse_float(token, values[count]))
+            valid = false;
+    }
+    return valid;
+}
+
+} // namespace
+
+bool ObjLineStream::open(const std::string &filename, const char *keyword)
+{
+    fs_.close();
+    fs_.clear();
+    fs_.open(filename, std::ios::binary);
+    keyword_ = keyword;
+    buffer_.resize(stream_buffer_size);
+    begin_ = end_ = 0;
+    line_ = 0;
+    eof_ = false;
+    return fs_.is_open();
+}
+
+bool ObjLineStream::rewind()
+{
+    fs_.clear();
+    fs_.seekg(0);
+    begin_ = end_ = 0;
+    line_ = 0;
+    eof_ = false;
+    return static_cast<bool>(fs_);
+}
+
+bool ObjLineStream::fill()
+{
+    // keep the partial line at the front, grow only when a single line fills the buffer
+    if(begin_ == 0 and end_ == buffer_.size())
+        buffer_.resize(buffer_.size() * 2);
+    std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+    fs_.read(buffer_.data() + end_, static_cast<std::streamsize>(buffer_.size() - end_));
+    const size_t read = static_cast<size_t>(fs_.gcount());
+    end_ += read;
+    if(read == 0 or not fs_)
+        eof_ = true;
+    return read > 0;
+}
+
+bool ObjLineStream::next(const char *&it, const char *&end, size_t &line)
+{
+    for(;;)
+    {
+        const char *data = buffer_.data();
+        const char *line_begin = data + begin_;
+        const void *newline = std::memchr(line_begin, '\n', end_ - begin_);
+        const char *line_end;
+        if(newline != nullptr)
+        {
+            line_end = static_cast<const char*>(newline);
+            begin_ = static_cast<size_t>(line_end - data) + 1;
+        }
+        else if(not eof_)
+        {
+            fill();
+            continue;
+        }
+        else if(begin_ < end_)
+        {
+            // last line without a newline
+            line_end = data + end_;
+            begin_ = end_;
+        }
+        else
+        {
+            return false;
+        }
+        const size_t number = line_++;
+        const char *cursor = line_begin;
+        if(next_token(cursor, line_end) == std::string_view(keyword_))
+        {
+            it = cursor;
+            end = line_end;
+            line = number;
+            return true;
+        }
+    }
+}
+
+bool CloudReader::open(const std::string &filename)
+{
+    filename_ = filename;
+    position_ = 0;
+    failed_ = false;
+    const std::string ext = file_extension(filename);
+    if(ext == "bpc")
+    {
+        bpc_ = true;
+        if(not mapped_.open(filename))
+            return false;
+        with_normals_ = mapped_.has_normals();
+        return true;
+    }
+    if(ext != "obj")
+    {
+        std::cout << "Error: "
+            << "unknown point cloud format for '"
+            << filename
+            << "', .obj or .bpc expected for streaming"
+            << std::endl;
+        return false;
+    }
+    bpc_ = false;
+    if(not vertices_.open(filename, "v") or not normals_.open(filename, "vn"))
+    {
+        std::cout << "Error: "
+            << "failed to open input obj file '"
+            << filename
+            << "', file not found, nothing loaded"
+            << std::endl;
+        return false;
+    }
+    // the normals are usually stored after all the points, finding the first one may read the whole file
+    const char *it, *end;
+    size_t line;
+    with_normals_ = normals_.next(it, end, line);
+    return normals_.rewind();
+}
+
+bool CloudReader::rewind()
+{
+    position_ = 0;
+    failed_ = false;
+    if(bpc_)
+        return mapped_.is_open();
+    return vertices_.rewind() and normals_.rewind();
+}
+
+bool CloudReader::next(size_t max_points, CloudChunk &chunk)
+{
+    if(failed_)
+        return false;
+    if(not bpc_)
+        return next_obj(max_points, chunk);
+
+    const size_t n = std::min(max_points, mapped_.size() - position_);
+    if(n == 0)
+        return false;
+    chunk.begin = position_;
+    chunk.size = n;
+    chunk.x = mapped_.x() + position_;
+    chunk.y = mapped_.y() + position_;
+    chunk.z = mapped_.z() + position_;
+    chunk.nx = with_normals_ ? mapped_.nx() + position_ : nullptr;
+    chunk.ny = with_normals_ ? mapped_.ny() + position_ : nullptr;
+    chunk.nz = with_normals_ ? mapped_.nz() + position_ : nullptr;
+    position_ += n;
+    return true;
+}
+
+bool CloudReader::next_obj(size_t max_points, CloudChunk &chunk)
+{
+    for(PointCloud::Buffer *buffer : {&x_, &y_, &z_})
+        buffer->resize(max_points);
+    if(with_normals_)
+        for(PointCloud::Buffer *buffer : {&nx_, &ny_, &nz_})
+            buffer->resize(max_points);
+
+    size_t n = 0;
+    const char *it, *end;
+    size_t line, count;
+    float values[6];
+    while(n < max_points and vertices_.next(it, end, line))
+    {
+        // line = "v x y z" or "v x y z r g b", the colors are not needed
+        if(not parse_values(it, end, values, count) or (count != 3 and count != 6))
+        {
+            obj_warning(filename_, line, "3 or 6 numbers expected after 'v'");
+            continue;
+        }
+        x_[n] = values[0];
+        y_[n] = values[1];
+        z_[n] = values[2];
+        if(with_normals_)
+        {
+            bool found = false;
+            while(not found and normals_.next(it, end, line))
+            {
+                found = parse_values(it, end, values, count) and count == 3;
+                if(not found)
+                    obj_warning(filename_, line, "3 numbers expected after 'vn'");
+            }
+            if(not found)
+            {
+                std::cout << "Error: "
+                    << "input obj file '"
+                    << filename_
+                    << "' has fewer normals than points"
+                    << std::endl;
+                failed_ = true;
+                return false;
+            }
+            nx_[n] = values[0];
+            ny_[n] = values[1];
+            nz_[n] = values[2];
+        }
+        ++n;
+    }
+    if(n == 0)
+        return false;
+    chunk.begin = position_;
+    chunk.size = n;
+    chunk.x = x_.data();
+    chunk.y = y_.data();
+    chunk.z = z_.data();
+    chunk.nx = with_normals_ ? nx_.data() : nullptr;
+    chunk.ny = with_normals_ ? ny_.data() : nullptr;
+    chunk.nz = with_normals_ ? nz_.data() : nullptr;
+    position_ += n;
+    return true;
+}
+
+bool CloudWriter::open(const std::string &filename, size_t count, bool with_normals)
+{
+    filename_ = filename;
+    count_ = count;
+    written_ = 0;
+    with_normals_ = with_normals;
+    const std::string ext = file_extension(filename);
+    if(ext != "ply" and ext != "bpc")
+    {
+        std::cout << "Error: "
+            << "unknown point cloud format for '"
+            << filename
+            << "', .ply or .bpc expected for streaming"
+            << std::endl;
+        return false;
+    }
+    bpc_ = ext == "bpc";
+    fs_.close();
+    fs_.clear();
+    fs_.open(filename, std::ios::binary);
+    if(not fs_.is_open())
+    {
+        std::cout << "Error: "
+            << "failed to open output file '"
+            << filename
+            << "', nothing saved"
+            << std::endl;
+        return false;
+    }
+    if(bpc_)
+    {
+        const BpcHeader header = bpc_header(count, (with_normals ? bpc_normals : 0) | bpc_colors | bpc_labels);
+        fs_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    else
+    {
+        write_ply_header(fs_, count, with_normals, true, true);
+    }
+    return static_cast<bool>(fs_);
+}
+
+bool CloudWriter::write(const CloudChunk &chunk, const float *r, const float *g, const float *b, const int32_t *labels)
+{
+    if(bpc_)
+    {
+        // every array is written at its own offset, the chunks fill them front to back
+        const float *arrays[] = {chunk.x, chunk.y, chunk.z, chunk.nx, chunk.ny, chunk.nz, r, g, b};
+        const size_t stride = bpc_array_stride(count_);
+        size_t slot = 0;
+        auto write_array = [&](const void *data)
+        {
+            fs_.seekp(static_cast<std::streamoff>(sizeof(BpcHeader) + slot * stride + chunk.begin * 4));
+            fs_.write(static_cast<const char*>(data), static_cast<std::streamsize>(chunk.size * 4));
+            ++slot;
+        };
+        for(size_t k = 0; k < 9; ++k)
+            if(k < 3 or k >= 6 or with_normals_)
+                write_array(arrays[k]);
+        write_array(labels);
+    }
+    else
+    {
+        const size_t stride = 12 + (with_normals_ ? 12 : 0) + 3 + 4;
+        buffer_.resize(chunk.size * stride);
+        char *out = buffer_.data();
+        auto put = [&out](const void *value, size_t size)
+        {
+            std::memcpy(out, value, size);
+            out += size;
+        };
+        for(size_t i = 0; i < chunk.size; ++i)
+        {
+            put(chunk.x + i, 4); put(chunk.y + i, 4); put(chunk.z + i, 4);
+            if(with_normals_)
+            {
+                put(chunk.nx + i, 4); put(chunk.ny + i, 4); put(chunk.nz + i, 4);
+            }
+            for(const float *channel : {r, g, b})
+            {
+                const uint8_t value = static_cast<uint8_t>(std::lround(std::min(1.0f, std::max(0.0f, channel[i])) * 255.0f));
+                put(&value, 1);
+            }
+            put(labels + i, 4);
+        }
+        fs_.write(buffer_.data(), static_cast<std::streamsize>(out - buffer_.data()));
+    }
+    written_ += chunk.size;
+    return static_cast<bool>(fs_);
+}
+
+bool CloudWriter::close()
+{
+    if(bpc_ and bpc_array_stride(count_) > count_ * 4)
+    {
+        // the padding of the last array is part of the file
+        const size_t arrays = (with_normals_ ? 6 : 3) + 3 + 1;
+        fs_.seekp(static_cast<std::streamoff>(sizeof(BpcHeader) + arrays * bpc_array_stride(count_) - 1));
+        fs_.put('\0');
+    }
+    fs_.close();
+    if(not fs_ or written_ != count_)
+    {
+        std::cout << "Error: "
+            << "failed to write output file '"
+            << filename_
+            << "', "
+            << written_
+            << " of "
+            << count_
+            << " points written"
+            << std::endl;
+        return false;
+    }
+    std::cout << "Saved "
+        << count_
+        << " points to '" << filename_ << "'" << std::endl;
+    return true;
+}
+
+} // namespace tnp
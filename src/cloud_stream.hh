@@ -0,0 +1,84 @@
+#pragma once
+#include <bpc.hh>
+#include <point_cloud.hh>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace tnp {
+
+// Consecutive points read by a CloudReader, the arrays stay valid until the next read
+struct CloudChunk {
+    size_t begin = 0; // index of the first point in the file
+    size_t size = 0;
+    const float *x = nullptr, *y = nullptr, *z = nullptr;
+    const float *nx = nullptr, *ny = nullptr, *nz = nullptr; // null without normals
+};
+
+// Buffered reader over the lines of an obj file starting with one keyword
+class ObjLineStream {
+public:
+    bool open(const std::string &filename, const char *keyword);
+    bool rewind();
+    // Next matching line, [it, end) is the rest of the line after the keyword and stays valid
+    // until the next call. `line` is the 0-based line number in the file.
+    bool next(const char *&it, const char *&end, size_t &line);
+
+private:
+    bool fill();
+
+    std::ifstream fs_;
+    std::string keyword_;
+    std::vector<char> buffer_;
+    size_t begin_ = 0, end_ = 0;
+    size_t line_ = 0;
+    bool eof_ = false;
+};
+
+// Reads a .bpc or .obj cloud chunk by chunk without holding it whole. A .bpc file is mapped
+// and the chunks point into the mapping. An .obj file is streamed in blocks with one cursor on
+// its 'v' lines and one on its 'vn' lines, so normals stored after the points still line up.
+class CloudReader {
+public:
+    bool open(const std::string &filename);
+    bool has_normals() const { return with_normals_; }
+    // Restarts from the first point
+    bool rewind();
+    // Reads up to max_points, false at the end of the file or after an error
+    bool next(size_t max_points, CloudChunk &chunk);
+    bool failed() const { return failed_; }
+
+private:
+    bool next_obj(size_t max_points, CloudChunk &chunk);
+
+    std::string filename_;
+    bool bpc_ = false;
+    MappedCloud mapped_;
+    ObjLineStream vertices_, normals_;
+    PointCloud::Buffer x_, y_, z_, nx_, ny_, nz_;
+    size_t position_ = 0;
+    bool with_normals_ = false;
+    bool failed_ = false;
+};
+
+// Writes a cloud chunk by chunk as .ply or .bpc, with colors and labels. The point count and
+// the attributes are fixed when the file is opened and the chunks must come in order.
+class CloudWriter {
+public:
+    bool open(const std::string &filename, size_t count, bool with_normals);
+    bool write(const CloudChunk &chunk, const float *r, const float *g, const float *b, const int32_t *labels);
+    bool close();
+
+private:
+    std::string filename_;
+    std::ofstream fs_;
+    bool bpc_ = false;
+    bool with_normals_ = false;
+    size_t count_ = 0;
+    size_t written_ = 0;
+    std::vector<char> buffer_;
+};
+
+} // namespace tnp
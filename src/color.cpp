@@ -9,11 +9,9 @@ std::vector<Eigen::Vector3f> distinctColors = {
         Eigen::Vector3f(0.0f, 1.0f, 1.0f), // Cyan
 };
 
-Eigen::Vector3f generate_random_color() {
-    std::random_device rd;
-    std::mt19937 rng(rd());
-    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-    return Eigen::Vector3f(dist(rng), dist(rng), dist(rng));
+Eigen::Vector3f generate_random_color(tnp::Rng &rng) {
+    const float r = rng.uniform(), g = rng.uniform();
+    return Eigen::Vector3f(r, g, rng.uniform());
 }
 
 Eigen::Vector3f generate_color(int colorIndex) {
@@ -22,8 +20,9 @@ Eigen::Vector3f generate_color(int colorIndex) {
         Eigen::Vector3f selectedColor = distinctColors[colorIndex];
         return selectedColor;
     } else {
-        Eigen::Vector3f newColor;
-        newColor = generate_random_color();
-        return newColor;
+        // seeded by the index, so a plane gets the same color in every run
+        tnp::Rng rng(static_cast<uint64_t>(colorIndex));
+        const float r = rng.uniform(), g = rng.uniform();
+        return Eigen::Vector3f(r, g, rng.uniform());
     }
 }
\ No newline at end of file
@@ -4,9 +4,11 @@
 #include <Eigen/Geometry>
 #include <vector>
 #include <random>
+#include "random.hh"
 
 extern std::vector<Eigen::Vector3f> distinctColors;
 
-Eigen::Vector3f generate_random_color();
+// Drawn from `rng`, so the colors follow its seed whichever thread draws them
+Eigen::Vector3f generate_random_color(tnp::Rng &rng);
 
 Eigen::Vector3f generate_color(int colorIndex);
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include "inlier_kernel.hh"
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RANSAC_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+namespace RANSAC {
+    namespace {
+        // Per-plane constants shared by every kernel
+        struct Plane {
+            float cx, cy, cz;
+            float nx, ny, nz;
+            float dist_threshold, align_threshold;
+        };
+
+        // Scalar tail shared by the SIMD kernels, same operation order as the vector lanes. The dot
+        // products are summed x + (y + z) like Eigen's, so the counts are those of
+        // point_to_plane_distance and calculate_alignement to the last bit.
+        size_t count_range(const PointsView &pts, const Plane &pl, size_t begin, size_t end) {
+            size_t inlier_count = 0;
+            for (size_t i = begin; i < end; ++i) {
+                const float dist = std::abs(pl.nx * (pts.x[i] - pl.cx) + (pl.ny * (pts.y[i] - pl.cy) + pl.nz * (pts.z[i] - pl.cz)));
+                bool inlier = dist < pl.dist_threshold;
+                if (pts.nx) {
+                    inlier &= std::abs(pts.nx[i] * pl.nx + (pts.ny[i] * pl.ny + pts.nz[i] * pl.nz)) >= pl.align_threshold;
+                }
+                inlier_count += inlier;
+            }
+            return inlier_count;
+        }
+
+        size_t count_scalar(const PointsView &pts, const Plane &pl) {
+            return count_range(pts, pl, 0, pts.size);
+        }
+
+#ifdef RANSAC_KERNEL_X86
+        size_t count_sse2(const PointsView &pts, const Plane &pl) {
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            const __m128 cx = _mm_set1_ps(pl.cx), cy = _mm_set1_ps(pl.cy), cz = _mm_set1_ps(pl.cz);
+            const __m128 nx = _mm_set1_ps(pl.nx), ny = _mm_set1_ps(pl.ny), nz = _mm_set1_ps(pl.nz);
+            const __m128 dist_threshold = _mm_set1_ps(pl.dist_threshold);
+            const __m128 align_threshold = _mm_set1_ps(pl.align_threshold);
+            // every lane holds -1 per inlier, subtracted from the accumulator
+            __m128i acc = _mm_setzero_si128();
+            const size_t end = pts.size & ~size_t(3);
+            for (size_t i = 0; i < end; i += 4) {
+                __m128 d = _mm_mul_ps(ny, _mm_sub_ps(_mm_loadu_ps(pts.y + i), cy));
+                d = _mm_add_ps(d, _mm_mul_ps(nz, _mm_sub_ps(_mm_loadu_ps(pts.z + i), cz)));
+                d = _mm_add_ps(_mm_mul_ps(nx, _mm_sub_ps(_mm_loadu_ps(pts.x + i), cx)), d);
+                __m128 mask = _mm_cmplt_ps(_mm_andnot_ps(sign, d), dist_threshold);
+                if (pts.nx) {
+                    __m128 a = _mm_mul_ps(_mm_loadu_ps(pts.ny + i), ny);
+                    a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(pts.nz + i), nz));
+                    a = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pts.nx + i), nx), a);
+                    mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_andnot_ps(sign, a), align_threshold));
+                }
+                acc = _mm_sub_epi32(acc, _mm_castps_si128(mask));
+            }
+            alignas(16) int lanes[4];
+            _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+            size_t inlier_count = 0;
+            for (int lane : lanes) inlier_count += static_cast<unsigned>(lane);
+            return inlier_count + count_range(pts, pl, end, pts.size);
+        }
+
+        __attribute__((target("avx2")))
+        size_t count_avx2(const PointsView &pts, const Plane &pl) {
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            const __m256 cx = _mm256_set1_ps(pl.cx), cy = _mm256_set1_ps(pl.cy), cz = _mm256_set1_ps(pl.cz);
+            const __m256 nx = _mm256_set1_ps(pl.nx), ny = _mm256_set1_ps(pl.ny), nz = _mm256_set1_ps(pl.nz);
+            const __m256 dist_threshold = _mm256_set1_ps(pl.dist_threshold);
+            const __m256 align_threshold = _mm256_set1_ps(pl.align_threshold);
+            __m256i acc = _mm256_setzero_si256();
+            const size_t end = pts.size & ~size_t(7);
+            for (size_t i = 0; i < end; i += 8) {
+                // separate mul and add, no FMA, so the rounding matches the scalar code
+                __m256 d = _mm256_mul_ps(ny, _mm256_sub_ps(_mm256_loadu_ps(pts.y + i), cy));
+                d = _mm256_add_ps(d, _mm256_mul_ps(nz, _mm256_sub_ps(_mm256_loadu_ps(pts.z + i), cz)));
+                d = _mm256_add_ps(_mm256_mul_ps(nx, _mm256_sub_ps(_mm256_loadu_ps(pts.x + i), cx)), d);
+                __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(sign, d), dist_threshold, _CMP_LT_OQ);
+                if (pts.nx) {
+                    __m256 a = _mm256_mul_ps(_mm256_loadu_ps(pts.ny + i), ny);
+                    a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(pts.nz + i), nz));
+                    a = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(pts.nx + i), nx), a);
+                    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_andnot_ps(sign, a), align_threshold, _CMP_GE_OQ));
+                }
+                acc = _mm256_sub_epi32(acc, _mm256_castps_si256(mask));
+            }
+            alignas(32) int lanes[8];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+            size_t inlier_count = 0;
+            for (int lane : lanes) inlier_count += static_cast<unsigned>(lane);
+            return inlier_count + count_range(pts, pl, end, pts.size);
+        }
+
+        __attribute__((target("avx512f")))
+        size_t count_avx512(const PointsView &pts, const Plane &pl) {
+            const __m512 cx = _mm512_set1_ps(pl.cx), cy = _mm512_set1_ps(pl.cy), cz = _mm512_set1_ps(pl.cz);
+            const __m512 nx = _mm512_set1_ps(pl.nx), ny = _mm512_set1_ps(pl.ny), nz = _mm512_set1_ps(pl.nz);
+            const __m512 dist_threshold = _mm512_set1_ps(pl.dist_threshold);
+            const __m512 align_threshold = _mm512_set1_ps(pl.align_threshold);
+            size_t inlier_count = 0;
+            const size_t end = pts.size & ~size_t(15);
+            for (size_t i = 0; i < end; i += 16) {
+                __m512 d = _mm512_mul_ps(ny, _mm512_sub_ps(_mm512_loadu_ps(pts.y + i), cy));
+                d = _mm512_add_ps(d, _mm512_mul_ps(nz, _mm512_sub_ps(_mm512_loadu_ps(pts.z + i), cz)));
+                d = _mm512_add_ps(_mm512_mul_ps(nx, _mm512_sub_ps(_mm512_loadu_ps(pts.x + i), cx)), d);
+                __mmask16 mask = _mm512_cmp_ps_mask(_mm512_abs_ps(d), dist_threshold, _CMP_LT_OQ);
+                if (pts.nx) {
+                    __m512 a = _mm512_mul_ps(_mm512_loadu_ps(pts.ny + i), ny);
+                    a = _mm512_add_ps(a, _mm512_mul_ps(_mm512_loadu_ps(pts.nz + i), nz));
+                    a = _mm512_add_ps(_mm512_mul_ps(_mm512_loadu_ps(pts.nx + i), nx), a);
+                    mask = _mm512_mask_cmp_ps_mask(mask, _mm512_abs_ps(a), align_threshold, _CMP_GE_OQ);
+                }
+                inlier_count += __builtin_popcount(static_cast<unsigned>(mask));
+            }
+            return inlier_count + count_range(pts, pl, end, pts.size);
+        }
+#endif
+
+        using Kernel = size_t (*)(const PointsView &, const Plane &);
+
+        struct Dispatch {
+            Kernel kernel;
+            const char *name;
+        };
+
+        // Kernels the CPU supports, widest first
+        std::vector<Dispatch> supported_kernels() {
+            std::vector<Dispatch> kernels;
+#ifdef RANSAC_KERNEL_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) kernels.push_back({count_avx512, "avx512"});
+            if (__builtin_cpu_supports("avx2")) kernels.push_back({count_avx2, "avx2"});
+            kernels.push_back({count_sse2, "sse2"});
+#endif
+            kernels.push_back({count_scalar, "scalar"});
+            return kernels;
+        }
+
+        Dispatch select_kernel() {
+            return supported_kernels().front();
+        }
+
+        const Dispatch &dispatch() {
+            static const Dispatch selected = select_kernel();
+            return selected;
+        }
+
+        Plane make_plane(const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal, float dist_threshold, float align_threshold) {
+            return {centroid.x(), centroid.y(), centroid.z(), normal.x(), normal.y(), normal.z(), dist_threshold, align_threshold};
+        }
+    }
+
+    size_t count_inliers(const PointsView &pts, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal,
+                         float dist_threshold, float align_threshold) {
+        return dispatch().kernel(pts, make_plane(centroid, normal, dist_threshold, align_threshold));
+    }
+
+    size_t count_inliers_scalar(const PointsView &pts, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal,
+                                float dist_threshold, float align_threshold) {
+        return count_scalar(pts, make_plane(centroid, normal, dist_threshold, align_threshold));
+    }
+
+    const char *inlier_kernel_name() {
+        return dispatch().name;
+    }
+
+    std::vector<const char *> inlier_kernels() {
+        std::vector<const char *> names;
+        for (const Dispatch &kernel : supported_kernels()) names.push_back(kernel.name);
+        return names;
+    }
+
+    size_t count_inliers_with(const char *kernel, const PointsView &pts, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal,
+                              float dist_threshold, float align_threshold) {
+        for (const Dispatch &candidate : supported_kernels()) {
+            if (std::strcmp(candidate.name, kernel) == 0) {
+                return candidate.kernel(pts, make_plane(centroid, normal, dist_threshold, align_threshold));
+            }
+        }
+        return count_scalar(pts, make_plane(centroid, normal, dist_threshold, align_threshold));
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <Eigen/Core>
+#include <cstddef>
+#include <vector>
+
+namespace RANSAC {
+    // Structure-of-arrays view over the points hypotheses are scored against
+    struct PointsView {
+        const float *x = nullptr, *y = nullptr, *z = nullptr;
+        const float *nx = nullptr, *ny = nullptr, *nz = nullptr; // null when normals are not tested
+        size_t size = 0;
+
+        Eigen::Vector3f point(size_t i) const { return {x[i], y[i], z[i]}; }
+        // Sub-view over [begin, begin + count)
+        PointsView slice(size_t begin, size_t count) const {
+            PointsView s = *this;
+            s.x += begin; s.y += begin; s.z += begin;
+            if (nx) { s.nx += begin; s.ny += begin; s.nz += begin; }
+            s.size = count;
+            return s;
+        }
+    };
+
+    // Counts the points with |normal.(p - centroid)| < dist_threshold and, when the view has
+    // normals, |n_p.normal| >= align_threshold. Uses the widest SIMD kernel the CPU supports.
+    size_t count_inliers(const PointsView &pts, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal,
+                         float dist_threshold, float align_threshold);
+    // Portable reference implementation of count_inliers
+    size_t count_inliers_scalar(const PointsView &pts, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal,
+                                float dist_threshold, float align_threshold);
+    // Name of the kernel selected at runtime: "avx512", "avx2", "sse2" or "scalar"
+    const char *inlier_kernel_name();
+    // Names of the kernels compiled in that this CPU can run, "scalar" included
+    std::vector<const char *> inlier_kernels();
+    // count_inliers with the named kernel, which must be one of inlier_kernels()
+    size_t count_inliers_with(const char *kernel, const PointsView &pts, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal,
+                              float dist_threshold, float align_threshold);
+}
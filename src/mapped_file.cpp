@@ -0,0 +1,83 @@
+#include "mapped_file.hh"
+
+#include <algorithm>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TNP_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tnp {
+
+bool MappedFile::open(const std::string &filename)
+{
+    close();
+#ifdef TNP_HAS_MMAP
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if(size_ > 0)
+    {
+        void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED)
+        {
+            // the file is scanned front to back
+            ::madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+            mapped_ = true;
+        }
+    }
+    ::close(fd);
+    if(mapped_ or size_ == 0)
+    {
+        open_ = true;
+        return true;
+    }
+#endif
+    // fallback, the whole file is read in large blocks
+    std::ifstream fs(filename, std::ios::binary | std::ios::ate);
+    if(not fs.is_open())
+        return false;
+    size_ = static_cast<size_t>(fs.tellg());
+    char *buffer = new char[size_ > 0 ? size_ : 1];
+    fs.seekg(0);
+    constexpr size_t block = size_t(1) << 24;
+    for(size_t offset = 0; offset < size_ and fs; offset += block)
+        fs.read(buffer + offset, static_cast<std::streamsize>(std::min(block, size_ - offset)));
+    if(not fs)
+    {
+        delete[] buffer;
+        size_ = 0;
+        return false;
+    }
+    data_ = buffer;
+    open_ = true;
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef TNP_HAS_MMAP
+    if(mapped_)
+        ::munmap(const_cast<char*>(data_), size_);
+    else
+#endif
+        delete[] data_;
+    data_ = nullptr;
+    size_ = 0;
+    open_ = false;
+    mapped_ = false;
+}
+
+} // namespace tnp
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace tnp {
+
+// Read-only view over a whole file, memory mapped where the platform allows it and read
+// into memory in large blocks otherwise
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string &filename) { open(filename); }
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &filename);
+    void close();
+
+    bool is_open() const { return open_; }
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    const char *begin() const { return data_; }
+    const char *end() const { return data_ + size_; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    bool open_ = false;
+    bool mapped_ = false;
+};
+
+} // namespace tnp
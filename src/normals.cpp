@@ -0,0 +1,333 @@
+#include "normals.hh"
+
+#include <parallel.hh>
+#include <profile.hh>
+
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tnp {
+
+namespace {
+
+// Cell coordinates are packed in 21 bits each, counted from the corner of the bounding box
+constexpr int key_bits = 21;
+constexpr int64_t key_max = (int64_t(1) << key_bits) - 1;
+
+uint64_t pack(int64_t x, int64_t y, int64_t z)
+{
+    return (uint64_t(x) << (2 * key_bits)) | (uint64_t(y) << key_bits) | uint64_t(z);
+}
+
+// Points of the subsample used to size the cells
+constexpr size_t calibration_points = size_t(1) << 16;
+
+// Cells handed to a task at once, the grid is cut in many more tasks than threads to balance the load
+constexpr size_t cells_per_task = 1024;
+
+} // namespace
+
+void estimate_normals(PointCloud &cloud, int neighbors, int threads)
+{
+    TNP_SCOPE("estimate_normals");
+    const size_t n = cloud.size();
+    if(not cloud.has_normals())
+        cloud.add_normals();
+    if(n == 0)
+        return;
+    const size_t k = static_cast<size_t>(std::max(3, neighbors));
+    const unsigned workers = resolve_threads(threads);
+    const size_t slices = std::max<size_t>(1, std::min<size_t>(workers, n));
+    const float *xs = cloud.x().data(), *ys = cloud.y().data(), *zs = cloud.z().data();
+    auto slice_begin = [&](size_t s) { return n * s / slices; };
+
+    // bounding box
+    using Box = std::pair<Eigen::Vector3f, Eigen::Vector3f>;
+    const Box empty(Eigen::Vector3f::Constant(std::numeric_limits<float>::max()), Eigen::Vector3f::Constant(std::numeric_limits<float>::lowest()));
+    const Box box = parallel_reduce(slices, workers, empty, [&](size_t s)
+    {
+        Box slice = empty;
+        for(size_t i = slice_begin(s); i < slice_begin(s + 1); ++i)
+        {
+            const Eigen::Vector3f p(xs[i], ys[i], zs[i]);
+            slice.first = slice.first.cwiseMin(p);
+            slice.second = slice.second.cwiseMax(p);
+        }
+        return slice;
+    }, [](const Box &a, const Box &b)
+    {
+        return Box(a.first.cwiseMin(b.first), a.second.cwiseMax(b.second));
+    });
+    const Eigen::Vector3f low = box.first, high = box.second;
+    const float extent = std::max(1e-6f, (high - low).maxCoeff());
+
+    // cells sized on a subsample: m points in cells of size c hold as many points per cell as the
+    // whole cloud in cells of size c * sqrt(m / n), the points being spread over surfaces. The
+    // occupancy is the one seen by the average point, so isolated outliers do not inflate the cells.
+    const size_t m = std::min(n, calibration_points);
+    float cell = std::max(1e-6f, (high - low).norm() * std::sqrt(static_cast<float>(k) / static_cast<float>(m)));
+    for(int round = 0; round < 3; ++round)
+    {
+        std::unordered_map<uint64_t, size_t> occupancy;
+        occupancy.reserve(m);
+        const float scale = 1.0f / cell;
+        for(size_t j = 0; j < m; ++j)
+        {
+            const size_t i = j * n / m;
+            ++occupancy[pack(std::min<int64_t>(key_max, static_cast<int64_t>((xs[i] - low.x()) * scale)),
+                             std::min<int64_t>(key_max, static_cast<int64_t>((ys[i] - low.y()) * scale)),
+                             std::min<int64_t>(key_max, static_cast<int64_t>((zs[i] - low.z()) * scale)))];
+        }
+        double seen = 0.0;
+        for(const auto &cell_count : occupancy)
+            seen += static_cast<double>(cell_count.second) * static_cast<double>(cell_count.second);
+        seen /= static_cast<double>(m);
+        cell *= static_cast<float>(std::sqrt(static_cast<double>(k) / seen));
+    }
+    cell *= std::sqrt(static_cast<float>(m) / static_cast<float>(n));
+    cell = std::max(cell, extent / static_cast<float>(key_max - 1));
+    const float scale = 1.0f / cell;
+
+    // points sorted by cell, slices are sorted in parallel then merged pairwise
+    std::vector<std::pair<uint64_t, size_t>> sorted(n);
+    parallel_for(slices, workers, [&](size_t s)
+    {
+        for(size_t i = slice_begin(s); i < slice_begin(s + 1); ++i)
+        {
+            sorted[i] = {pack(std::min<int64_t>(key_max, static_cast<int64_t>((xs[i] - low.x()) * scale)),
+                              std::min<int64_t>(key_max, static_cast<int64_t>((ys[i] - low.y()) * scale)),
+                              std::min<int64_t>(key_max, static_cast<int64_t>((zs[i] - low.z()) * scale))), i};
+        }
+        std::sort(sorted.begin() + slice_begin(s), sorted.begin() + slice_begin(s + 1));
+    });
+    for(size_t width = 1; width < slices; width *= 2)
+    {
+        parallel_for((slices + 2 * width - 1) / (2 * width), workers, [&](size_t pair)
+        {
+            const size_t first = 2 * width * pair;
+            const size_t middle = std::min(slices, first + width), last = std::min(slices, first + 2 * width);
+            std::inplace_merge(sorted.begin() + slice_begin(first), sorted.begin() + slice_begin(middle), sorted.begin() + slice_begin(last));
+        });
+    }
+
+    // coordinates in cell order, so the points of neighbor cells are read contiguously
+    std::vector<float> sx(n), sy(n), sz(n);
+    parallel_for(slices, workers, [&](size_t s)
+    {
+        for(size_t j = slice_begin(s); j < slice_begin(s + 1); ++j)
+        {
+            sx[j] = xs[sorted[j].second];
+            sy[j] = ys[sorted[j].second];
+            sz[j] = zs[sorted[j].second];
+        }
+    });
+
+    // occupied cells and the range of their points in `sorted`
+    std::vector<uint64_t> cell_keys;
+    std::vector<size_t> cell_begin;
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(i == 0 or sorted[i].first != sorted[i - 1].first)
+        {
+            cell_keys.push_back(sorted[i].first);
+            cell_begin.push_back(i);
+        }
+    }
+    cell_begin.push_back(n);
+    const size_t cells = cell_keys.size();
+
+    // candidates as a structure of arrays so the distances are computed on contiguous floats, the
+    // buffers of a worker are reused by all the tasks it runs
+    struct Scratch {
+        std::vector<float> near_x, near_y, near_z, distances, best;
+        std::vector<uint32_t> nearest;
+    };
+    PerWorker<Scratch> scratch;
+    const size_t tasks = (cells + cells_per_task - 1) / cells_per_task;
+    parallel_for(tasks, workers, [&](size_t t)
+    {
+        Scratch &local = scratch.local();
+        std::vector<float> &near_x = local.near_x, &near_y = local.near_y, &near_z = local.near_z;
+        std::vector<float> &distances = local.distances, &best = local.best;
+        std::vector<uint32_t> &nearest = local.nearest;
+        for(size_t c = t * cells_per_task; c < std::min(cells, (t + 1) * cells_per_task); ++c)
+        {
+            // points of the 27 cells around this one
+            const int64_t cx = int64_t(cell_keys[c] >> (2 * key_bits));
+            const int64_t cy = int64_t((cell_keys[c] >> key_bits) & uint64_t(key_max));
+            const int64_t cz = int64_t(cell_keys[c] & uint64_t(key_max));
+            near_x.clear();
+            near_y.clear();
+            near_z.clear();
+            for(int64_t x = std::max<int64_t>(0, cx - 1); x <= std::min(key_max, cx + 1); ++x)
+                for(int64_t y = std::max<int64_t>(0, cy - 1); y <= std::min(key_max, cy + 1); ++y)
+                {
+                    // z is in the low bits, the 3 cells of a column are one range of `sorted`
+                    const auto first = std::lower_bound(cell_keys.begin(), cell_keys.end(), pack(x, y, std::max<int64_t>(0, cz - 1)));
+                    const auto last = std::upper_bound(first, cell_keys.end(), pack(x, y, std::min(key_max, cz + 1)));
+                    const size_t begin = cell_begin[static_cast<size_t>(first - cell_keys.begin())];
+                    const size_t end = cell_begin[static_cast<size_t>(last - cell_keys.begin())];
+                    near_x.insert(near_x.end(), sx.begin() + begin, sx.begin() + end);
+                    near_y.insert(near_y.end(), sy.begin() + begin, sy.begin() + end);
+                    near_z.insert(near_z.end(), sz.begin() + begin, sz.begin() + end);
+                }
+            const size_t candidates = near_x.size();
+            const size_t count = std::min(k, candidates);
+            distances.resize(candidates);
+
+            for(size_t j = cell_begin[c]; j < cell_begin[c + 1]; ++j)
+            {
+                const size_t i = sorted[j].second;
+                if(count < 3)
+                {
+                    cloud.set_normal(i, Eigen::Vector3f::Zero());
+                    continue;
+                }
+                const float px = sx[j], py = sy[j], pz = sz[j];
+                for(size_t q = 0; q < candidates; ++q)
+                {
+                    const float dx = near_x[q] - px, dy = near_y[q] - py, dz = near_z[q] - pz;
+                    distances[q] = dx * dx + dy * dy + dz * dz;
+                }
+                // k nearest kept sorted by insertion, the earliest candidate wins ties
+                nearest.clear();
+                best.clear();
+                for(size_t q = 0; q < candidates; ++q)
+                {
+                    const float d = distances[q];
+                    if(best.size() == count and not (d < best.back()))
+                        continue;
+                    if(best.size() < count)
+                    {
+                        best.push_back(d);
+                        nearest.push_back(static_cast<uint32_t>(q));
+                    }
+                    size_t slot = best.size() - 1;
+                    for(; slot > 0 and d < best[slot - 1]; --slot)
+                    {
+                        best[slot] = best[slot - 1];
+                        nearest[slot] = nearest[slot - 1];
+                    }
+                    best[slot] = d;
+                    nearest[slot] = static_cast<uint32_t>(q);
+                }
+
+                // covariance of the neighbors around their mean
+                Eigen::Vector3f mean = Eigen::Vector3f::Zero();
+                for(const uint32_t q : nearest)
+                    mean += Eigen::Vector3f(near_x[q], near_y[q], near_z[q]);
+                mean /= static_cast<float>(count);
+                Eigen::Matrix3f covariance = Eigen::Matrix3f::Zero();
+                for(const uint32_t q : nearest)
+                {
+                    const Eigen::Vector3f d = Eigen::Vector3f(near_x[q], near_y[q], near_z[q]) - mean;
+                    covariance.noalias() += d * d.transpose();
+                }
+                Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> solver;
+                solver.computeDirect(covariance / static_cast<float>(count));
+                cloud.set_normal(i, solver.eigenvectors().col(0).normalized());
+            }
+        }
+    });
+}
+
+void estimate_organized_normals(PointCloud &cloud, size_t width, size_t height, int radius, int threads)
+{
+    TNP_SCOPE("estimate_organized_normals");
+    if(not cloud.has_normals())
+        cloud.add_normals();
+    if(width == 0 or height == 0 or cloud.size() != width * height)
+        return;
+    const unsigned workers = resolve_threads(threads);
+    const size_t r = static_cast<size_t>(std::max(1, radius));
+    const float *xs = cloud.x().data(), *ys = cloud.y().data(), *zs = cloud.z().data();
+
+    // integral images of the coordinates and of the valid pixel count, one row and column of zeros first
+    const size_t stride = width + 1;
+    std::vector<double> ix(stride * (height + 1), 0.0), iy(ix.size(), 0.0), iz(ix.size(), 0.0), in(ix.size(), 0.0);
+    parallel_for(height, workers, [&](size_t v)
+    {
+        double sx = 0.0, sy = 0.0, sz = 0.0, sn = 0.0;
+        for(size_t u = 0; u < width; ++u)
+        {
+            const size_t i = v * width + u;
+            if(std::isfinite(xs[i]) and std::isfinite(ys[i]) and std::isfinite(zs[i]))
+            {
+                sx += xs[i];
+                sy += ys[i];
+                sz += zs[i];
+                sn += 1.0;
+            }
+            const size_t cell = (v + 1) * stride + u + 1;
+            ix[cell] = sx;
+            iy[cell] = sy;
+            iz[cell] = sz;
+            in[cell] = sn;
+        }
+    });
+    // columns are summed down by bands of consecutive columns so the rows are read contiguously
+    constexpr size_t band = 256;
+    parallel_for((stride + band - 1) / band, workers, [&](size_t b)
+    {
+        for(size_t v = 1; v <= height; ++v)
+            for(size_t u = b * band; u < std::min(stride, (b + 1) * band); ++u)
+            {
+                ix[v * stride + u] += ix[(v - 1) * stride + u];
+                iy[v * stride + u] += iy[(v - 1) * stride + u];
+                iz[v * stride + u] += iz[(v - 1) * stride + u];
+                in[v * stride + u] += in[(v - 1) * stride + u];
+            }
+    });
+
+    // mean of the valid points of the pixels [u0, u1) x [v0, v1), false when there is none
+    auto window_mean = [&](size_t u0, size_t u1, size_t v0, size_t v1, Eigen::Vector3d &mean)
+    {
+        auto box = [&](const std::vector<double> &image)
+        {
+            return image[v1 * stride + u1] - image[v0 * stride + u1] - image[v1 * stride + u0] + image[v0 * stride + u0];
+        };
+        const double count = box(in);
+        if(count < 0.5)
+            return false;
+        mean = Eigen::Vector3d(box(ix), box(iy), box(iz)) / count;
+        return true;
+    };
+
+    parallel_for(height, workers, [&](size_t v)
+    {
+        for(size_t u = 0; u < width; ++u)
+        {
+            const size_t i = v * width + u;
+            const Eigen::Vector3f p(xs[i], ys[i], zs[i]);
+            Eigen::Vector3d left, right, up, down;
+            const size_t u0 = u >= r ? u - r : 0, u1 = std::min(width, u + r + 1);
+            const size_t v0 = v >= r ? v - r : 0, v1 = std::min(height, v + r + 1);
+            if(not p.allFinite()
+               or not window_mean(u0, u, v0, v1, left) or not window_mean(u + 1, u1, v0, v1, right)
+               or not window_mean(u0, u1, v0, v, up) or not window_mean(u0, u1, v + 1, v1, down))
+            {
+                cloud.set_normal(i, Eigen::Vector3f::Zero());
+                continue;
+            }
+            Eigen::Vector3f normal = (right - left).cross(down - up).cast<float>();
+            const float norm = normal.norm();
+            if(not (norm > 0.0f))
+            {
+                cloud.set_normal(i, Eigen::Vector3f::Zero());
+                continue;
+            }
+            normal /= norm;
+            if(normal.dot(p) > 0.0f)
+                normal = -normal;
+            cloud.set_normal(i, normal);
+        }
+    });
+}
+
+} // namespace tnp
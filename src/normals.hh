@@ -0,0 +1,21 @@
+#pragma once
+#include <point_cloud.hh>
+
+namespace tnp {
+
+// Fills the normals of the cloud from its `neighbors` nearest points: the normal of a point is the
+// eigenvector of the smallest eigenvalue of their covariance. Neighbors are searched in the 27
+// cells around the point on a hashed grid sized to hold about `neighbors` points per cell, so the
+// cost is O(N) and the search is approximate near the cell borders. Normals are not oriented, a
+// point with fewer than 3 points around it gets a zero normal. The work is split over `threads`
+// threads, 0 or less meaning all hardware threads, and the result does not depend on their count.
+void estimate_normals(PointCloud &cloud, int neighbors = 16, int threads = 0);
+
+// Fills the normals of an organized cloud, which must hold `width` x `height` points stored row by
+// row as a depth camera sees them, points with a non-finite coordinate being missing. The normal of a pixel is the
+// cross product of the horizontal and vertical tangents between the means of the windows of
+// `radius` pixels on each side of it, read from integral images in O(1) whatever the radius. Normals
+// face the viewpoint at the origin, a pixel without valid points on every side gets a zero normal.
+void estimate_organized_normals(PointCloud &cloud, size_t width, size_t height, int radius = 4, int threads = 0);
+
+} // namespace tnp
@@ -1,28 +1,232 @@
 #include <obj.h>
 
+#include <mapped_file.hh>
+#include <obj_tokens.hh>
+#include <parallel.hh>
+#include <profile.hh>
+
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <sstream>
 
 namespace tnp {
 
-template<typename Out>
-void split(const std::string& str, char delim, Out result) 
+int io_threads = 0;
+int obj_precision = 6;
+
+namespace {
+
+// Estimated number of 'v' and 'vn' lines, from a memchr scan of the line starts that is
+// much cheaper than the parsing and lets the vectors be allocated once
+void estimate_counts(const char* begin, const char* end, size_t& points, size_t& normals)
+{
+    points = 0;
+    normals = 0;
+    for(const char* it = begin; it + 1 < end; )
+    {
+        if(it[0] == 'v')
+        {
+            if(it[1] == 'n') ++normals;
+            else ++points;
+        }
+        const void* line_end = std::memchr(it, '\n', static_cast<size_t>(end - it));
+        if(line_end == nullptr) 
+            break;
+        it = static_cast<const char*>(line_end) + 1;
+    }
+}
+
+// Warning raised while parsing a chunk, the line is relative to the chunk start
+struct ObjWarning {
+    size_t line;
+    std::string message;
+};
+
+// Byte range of an obj file parsed by one task, and what was read from it
+struct ObjChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    size_t lines = 0;
+    std::vector<Eigen::Vector3f> points, normals, colors;
+    std::vector<ObjWarning> warnings;
+};
+
+// First line start at or after `pos`, `begin` being itself a line start
+const char* line_start(const char* begin, const char* pos, const char* end)
+{
+    if(pos <= begin) 
+        return begin;
+    const void* newline = std::memchr(pos - 1, '\n', static_cast<size_t>(end - pos + 1));
+    return newline == nullptr ? end : static_cast<const char*>(newline) + 1;
+}
+
+void parse_chunk(const std::string& filename, ObjChunk& chunk)
+{
+    size_t expected_points = 0, expected_normals = 0;
+    estimate_counts(chunk.begin, chunk.end, expected_points, expected_normals);
+    chunk.points.reserve(expected_points);
+    chunk.normals.reserve(expected_normals);
+    TNP_ALLOCATION(chunk.points.capacity() * sizeof(Eigen::Vector3f));
+    if(chunk.normals.capacity() > 0)
+        TNP_ALLOCATION(chunk.normals.capacity() * sizeof(Eigen::Vector3f));
+
+    const char* const end = chunk.end;
+    const char* next_line = chunk.begin;
+    for(size_t& idx_line = chunk.lines; next_line < end; ++idx_line)
+    {
+        const char* it = next_line;
+        const char* line_end = static_cast<const char*>(std::memchr(it, '\n', static_cast<size_t>(end - it)));
+        if(line_end == nullptr) 
+            line_end = end;
+        next_line = line_end + 1;
+
+        const std::string_view keyword = next_token(it, line_end);
+        if(keyword.empty() or keyword.front() == '#')
+        {
+            // empty line or comment = "# ..."
+            // nothing to do
+            continue;
+        }
+
+        const bool vertex = keyword == "v";
+        if(not vertex and keyword != "vn")
+        {
+            std::ostringstream message;
+            message << " of input obj file '" 
+                << filename 
+                << "', 'v' or 'vn' expected but '" 
+                << keyword
+                << "' read instead, line skipped";
+            chunk.warnings.push_back({idx_line, message.str()});
+            continue;
+        }
+
+        // line = "v x y z", "v x y z r g b" or "vn nx ny nz"
+        float values[6];
+        size_t count = 0;
+        bool valid = true;
+        for(std::string_view token = next_token(it, line_end); not token.empty(); token = next_token(it, line_end), ++count)
+        {
+            if(count < 6 and valid and not parse_float(token, values[count]))
+            {
+                std::ostringstream message;
+                message << " of input obj file '" 
+                    << filename 
+                    << "', '"
+                    << token
+                    << "' is not a number, line skipped";
+                chunk.warnings.push_back({idx_line, message.str()});
+                valid = false;
+            }
+        }
+        if(not valid) 
+            continue;
+
+        if(vertex and (count == 3 or count == 6))
+        {
+            chunk.points.emplace_back(values[0], values[1], values[2]);
+            if(count == 6)
+            {
+                if(chunk.colors.capacity() == 0) 
+                {
+                    chunk.colors.reserve(chunk.points.capacity());
+                    TNP_ALLOCATION(chunk.colors.capacity() * sizeof(Eigen::Vector3f));
+                }
+                chunk.colors.emplace_back(values[3], values[4], values[5]);
+            }
+        }
+        else if(not vertex and count == 3)
+        {
+            chunk.normals.emplace_back(values[0], values[1], values[2]);
+        }
+        else
+        {
+            std::ostringstream message;
+            message << " of input obj file '" 
+                << filename 
+                << "', "
+                << (vertex ? "3 or 6" : "3")
+                << " values expected but "
+                << count
+                << " read instead, line skipped";
+            chunk.warnings.push_back({idx_line, message.str()});
+        }
+    } // end of loop
+}
+
+// Longest float or int written by the formatter, "-1.23456789e-38" fits with room to spare
+constexpr int max_value_chars = 24;
+// Longest line written, "v x y z r g b\n"
+constexpr size_t max_line_chars = 2 + 6 * (max_value_chars + 1);
+
+// Appends " x y z" to `out` with obj_precision significant digits, at most max_digits10: more
+// digits would not change the float read back and would not fit in max_value_chars
+char* write_vector(char* out, const Eigen::Vector3f& v)
 {
-    std::istringstream ss(str);
-    std::string token;
-    while(std::getline(ss, token, delim)) 
+    const int precision = std::min(obj_precision, std::numeric_limits<float>::max_digits10);
+    for(int k = 0; k < 3; ++k)
     {
-        *result++ = token;
+        *out++ = ' ';
+        const auto result = precision > 0
+            ? std::to_chars(out, out + max_value_chars, v[k], std::chars_format::general, precision)
+            : std::to_chars(out, out + max_value_chars, v[k]);
+        out = result.ptr;
     }
+    return out;
 }
 
-std::vector<std::string> split(const std::string& str, char delim = ' ') 
+// Formats `count` lines with format(i, out), which returns the end of line i written at `out`,
+// in parallel blocks and writes the blocks to the stream in order. Returns the bytes written.
+template<typename Format>
+size_t write_lines(std::ofstream& fs, size_t count, unsigned threads, Format format)
 {
-    std::vector<std::string> tokens;
-    split(str, delim, std::back_inserter(tokens));
-    return tokens;
+    size_t written = 0;
+    constexpr size_t block_lines = size_t(1) << 14;
+    const size_t block_count = (count + block_lines - 1) / block_lines;
+    // a bounded number of blocks is formatted at once to keep the memory flat
+    const size_t batch = size_t(threads) * 2;
+    std::vector<std::string> buffers(std::min(block_count, batch));
+    for(size_t first = 0; first < block_count; first += batch)
+    {
+        const size_t blocks = std::min(batch, block_count - first);
+        parallel_for(blocks, threads, [&](size_t b)
+        {
+            const size_t begin = (first + b) * block_lines;
+            const size_t end = std::min(count, begin + block_lines);
+            std::string& buffer = buffers[b];
+            const size_t capacity = buffer.capacity();
+            buffer.resize((end - begin) * max_line_chars);
+            if(buffer.capacity() > capacity)
+                TNP_ALLOCATION(buffer.capacity());
+            char* out = &buffer[0];
+            for(size_t i = begin; i < end; ++i)
+            {
+                out = format(i, out);
+                *out++ = '\n';
+            }
+            buffer.resize(static_cast<size_t>(out - buffer.data()));
+        });
+        for(size_t b = 0; b < blocks and fs; ++b)
+        {
+            fs.write(buffers[b].data(), static_cast<std::streamsize>(buffers[b].size()));
+            written += buffers[b].size();
+        }
+    }
+    return written;
 }
 
+bool write_obj(
+    const std::string& filename, 
+    const std::vector<Eigen::Vector3f>& points,
+    const std::vector<Eigen::Vector3f>& normals,
+    const std::vector<Eigen::Vector3f>& colors,
+    const std::vector<Eigen::Vector3i>& faces);
+
+} // namespace
+
 bool load_obj(
     const std::string& filename, 
     std::vector<Eigen::Vector3f>& points)
@@ -40,7 +244,9 @@ bool load_obj(
     return load_obj(filename, points, normals, colors);
 }
 
-bool load_obj(
+namespace {
+
+bool read_obj(
     const std::string& filename, 
     std::vector<Eigen::Vector3f>& points,
     std::vector<Eigen::Vector3f>& normals,
@@ -50,8 +256,8 @@ bool load_obj(
     normals.clear();
     colors.clear();
 
-    std::ifstream fs(filename);
-    if(not fs.is_open())
+    MappedFile file(filename);
+    if(not file.is_open())
     {
         std::cout << "Error: "
             << "failed to open input obj file '" 
@@ -61,95 +267,53 @@ bool load_obj(
         return false;
     }
 
-    std::string line;
-    for(auto idx_line = 0; std::getline(fs, line); ++idx_line)
+    TNP_COUNT("bytes parsed", file.size());
+
+    // chunks of at least 1 MB aligned on line starts, a few per thread to balance the load
+    constexpr size_t min_chunk_size = size_t(1) << 20;
+    const unsigned threads = resolve_threads(io_threads);
+    const size_t chunk_count = std::max<size_t>(1, std::min<size_t>(size_t(threads) * 4, file.size() / min_chunk_size));
+    std::vector<ObjChunk> chunks(chunk_count);
+    for(size_t i = 0; i < chunk_count; ++i)
     {
-        const auto tokens = split(line);
-        if(line.empty()) 
-        {
-            // empty line
-            // nothing to do
-        }
-        else if(line.front() == '#')
-        {
-            // comment = "# ..."
-            // nothing to do
-        }
-        if(not tokens.empty() and tokens.front() == "v")
-        {
-            // line = "v x y z"
-            // or line = "v x y z r g b"
-            if(tokens.size() == 4)
-            {
-                points.push_back(Eigen::Vector3f{
-                    std::stof(tokens[1]),
-                    std::stof(tokens[2]),
-                    std::stof(tokens[3])
-                });
-            }
-            else if(tokens.size() == 7)
-            {
-                points.push_back(Eigen::Vector3f{
-                    std::stof(tokens[1]),
-                    std::stof(tokens[2]),
-                    std::stof(tokens[3])
-                });
-                colors.push_back(Eigen::Vector3f{
-                    std::stof(tokens[4]),
-                    std::stof(tokens[5]),
-                    std::stof(tokens[6])
-                });
-            }
-            else
-            {
-                std::cout << "Warning: "
-                    << "failed to read line " 
-                    << idx_line 
-                    << " of input obj file '" 
-                    << filename 
-                    << "', 3 or 6 values expected but "
-                    << tokens.size()-1 // -1 for the front token (v) 
-                    << " read instead, line skipped" 
-                    << std::endl;
-            }
-        }
-        else if(not tokens.empty() and tokens.front() == "vn")
-        {
-            // line = "vn nx ny nz"
-            if(tokens.size() == 4)
-            {
-                normals.push_back(Eigen::Vector3f{
-                    std::stof(tokens[1]),
-                    std::stof(tokens[2]),
-                    std::stof(tokens[3])
-                });
-            }
-            else
-            {
-                std::cout << "Warning: "
-                    << "failed to read line " 
-                    << idx_line 
-                    << " of input obj file '" 
-                    << filename 
-                    << "', 3 values expected but "
-                    << tokens.size()-1 // -1 for the front token (vn) 
-                    << " read instead, line skipped" 
-                    << std::endl;
-            }
-        }
-        else
-        {
-            std::cout << "Warning: " 
-                << "failed to read line " 
-                << idx_line 
-                << " of input obj file '" 
-                << filename 
-                << "', 'v' or 'vn' expected but '" 
-                << tokens.front()
-                << "' read instead, line skipped"
-                << std::endl;
-        }
-    } // end of loop
+        chunks[i].begin = i == 0 ? file.begin() : chunks[i - 1].end;
+        chunks[i].end = i + 1 == chunk_count ? file.end() : line_start(chunks[i].begin, file.begin() + file.size() * (i + 1) / chunk_count, file.end());
+    }
+    parallel_for(chunk_count, threads, [&](size_t i) { parse_chunk(filename, chunks[i]); });
+
+    // concatenated in file order so normals[i] still matches points[i]
+    size_t point_count = 0, normal_count = 0, color_count = 0, line_offset = 0;
+    for(ObjChunk& chunk : chunks)
+    {
+        for(const ObjWarning& warning : chunk.warnings)
+            std::cout << "Warning: failed to read line " << line_offset + warning.line << warning.message << std::endl;
+        line_offset += chunk.lines;
+        point_count += chunk.points.size();
+        normal_count += chunk.normals.size();
+        color_count += chunk.colors.size();
+    }
+    points.resize(point_count);
+    normals.resize(normal_count);
+    colors.resize(color_count);
+    for(const size_t count : {point_count, normal_count, color_count})
+    {
+        if(count > 0)
+            TNP_ALLOCATION(count * sizeof(Eigen::Vector3f));
+    }
+    std::vector<size_t> point_offsets(chunk_count + 1, 0), normal_offsets(chunk_count + 1, 0), color_offsets(chunk_count + 1, 0);
+    for(size_t i = 0; i < chunk_count; ++i)
+    {
+        point_offsets[i + 1] = point_offsets[i] + chunks[i].points.size();
+        normal_offsets[i + 1] = normal_offsets[i] + chunks[i].normals.size();
+        color_offsets[i + 1] = color_offsets[i] + chunks[i].colors.size();
+    }
+    parallel_for(chunk_count, threads, [&](size_t i) 
+    {
+        std::copy(chunks[i].points.begin(), chunks[i].points.end(), points.begin() + point_offsets[i]);
+        std::copy(chunks[i].normals.begin(), chunks[i].normals.end(), normals.begin() + normal_offsets[i]);
+        std::copy(chunks[i].colors.begin(), chunks[i].colors.end(), colors.begin() + color_offsets[i]);
+        chunks[i] = ObjChunk();
+    });
 
     if(points.size() == 0) 
     {
@@ -199,6 +363,43 @@ bool load_obj(
     return true;
 }
 
+} // namespace
+
+bool load_obj(
+    const std::string& filename, 
+    std::vector<Eigen::Vector3f>& points,
+    std::vector<Eigen::Vector3f>& normals,
+    std::vector<Eigen::Vector3f>& colors)
+{
+    TNP_SCOPE("load_obj");
+    return read_obj(filename, points, normals, colors);
+}
+
+bool load_obj(
+    const std::string& filename, 
+    PointCloud& cloud)
+{
+    TNP_SCOPE("load_obj");
+    std::vector<Eigen::Vector3f> points, normals, colors;
+    if(not read_obj(filename, points, normals, colors))
+    {
+        cloud.clear();
+        return false;
+    }
+    cloud = PointCloud(points, normals, colors);
+    return true;
+}
+
+bool save_obj(
+    const std::string& filename, 
+    const PointCloud& cloud)
+{
+    TNP_SCOPE("save_obj");
+    std::vector<Eigen::Vector3f> points, normals, colors;
+    cloud.to_vectors(points, normals, colors);
+    return write_obj(filename, points, normals, colors, {});
+}
+
 bool save_obj(
     const std::string& filename, 
     const std::vector<Eigen::Vector3f>& points,
@@ -394,7 +595,20 @@ bool save_obj(
     const std::vector<Eigen::Vector3f>& colors,
     const std::vector<Eigen::Vector3i>& faces)
 {
-    std::ofstream fs(filename);
+    TNP_SCOPE("save_obj");
+    return write_obj(filename, points, normals, colors, faces);
+}
+
+namespace {
+
+bool write_obj(
+    const std::string& filename, 
+    const std::vector<Eigen::Vector3f>& points,
+    const std::vector<Eigen::Vector3f>& normals,
+    const std::vector<Eigen::Vector3f>& colors,
+    const std::vector<Eigen::Vector3i>& faces)
+{
+    std::ofstream fs(filename, std::ios::binary);
     if(not fs.is_open())
     {
         std::cout << "Error: "
@@ -443,41 +657,47 @@ bool save_obj(
             << std::endl;
     }
 
-    for(auto i = 0u; i < points.size(); ++i)
+    const unsigned threads = resolve_threads(io_threads);
+    size_t written = write_lines(fs, points.size(), threads, [&](size_t i, char* out)
     {
-        fs << "v " 
-            << points[i].x() << ' '
-            << points[i].y() << ' '
-            << points[i].z();
+        *out++ = 'v';
+        out = write_vector(out, points[i]);
         if(save_colors)
-        {
-            fs << ' '
-                << colors[i].x() << ' '
-                << colors[i].y() << ' '
-                << colors[i].z();
-        }
-        fs << '\n';
-    }
+            out = write_vector(out, colors[i]);
+        return out;
+    });
     if(save_normals)
     {
-        for(auto i = 0u; i < normals.size(); ++i)
+        written += write_lines(fs, normals.size(), threads, [&](size_t i, char* out)
         {
-            fs << "vn " 
-                << normals[i].x() << ' '
-                << normals[i].y() << ' '
-                << normals[i].z() << '\n';
-        }   
+            *out++ = 'v';
+            *out++ = 'n';
+            return write_vector(out, normals[i]);
+        });
     }
     if(not faces.empty())
     {
-        for(auto i = 0u; i < faces.size(); ++i)
+        written += write_lines(fs, faces.size(), threads, [&](size_t i, char* out)
         {
-            // +1 because obj indices start at 1!
-            fs << "f "
-                << faces[i][0]+1 << ' '
-                << faces[i][1]+1 << ' '
-                << faces[i][2]+1 << '\n';
-        }
+            *out++ = 'f';
+            for(int k = 0; k < 3; ++k)
+            {
+                // +1 because obj indices start at 1!
+                *out++ = ' ';
+                out = std::to_chars(out, out + max_value_chars, faces[i][k] + 1).ptr;
+            }
+            return out;
+        });
+    }
+    TNP_COUNT("bytes written", written);
+    if(not fs)
+    {
+        std::cout << "Error: "
+            << "failed to write output obj file '" 
+            << filename 
+            << "'" 
+            << std::endl;
+        return false;
     }
 
     std::cout << "Saved " 
@@ -495,4 +715,6 @@ bool save_obj(
     return true;
 }
 
-} // namespace tnp
\ No newline at end of file
+} // namespace
+
+} // namespace tnp
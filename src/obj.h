@@ -1,12 +1,20 @@
 #pragma once
 
 #include <Eigen/Core>
+#include <point_cloud.hh>
 
 #include <string>
 #include <vector>
 
 namespace tnp {
 
+// Threads used to parse and format obj files, 0 or less means all hardware threads
+extern int io_threads;
+// Significant digits of the floats saved to obj files, 6 like std::ostream by default.
+// 0 or less writes the shortest representation that reads back to the same float,
+// more than 9 (std::numeric_limits<float>::max_digits10) writes 9.
+extern int obj_precision;
+
 bool load_obj(
     const std::string& filename, 
     std::vector<Eigen::Vector3f>& points);
@@ -22,12 +30,20 @@ bool load_obj(
     std::vector<Eigen::Vector3f>& normals,
     std::vector<Eigen::Vector3f>& colors);
 
+bool load_obj(
+    const std::string& filename, 
+    PointCloud& cloud);
+
 bool save_obj(
     const std::string& filename, 
     const std::vector<Eigen::Vector3f>& points,
     const std::vector<Eigen::Vector3f>& normals,
     const std::vector<Eigen::Vector3f>& colors);
 
+bool save_obj(
+    const std::string& filename, 
+    const PointCloud& cloud);
+
 bool save_obj(
     const std::string& filename, 
     const std::vector<Eigen::Vector3f>& points,
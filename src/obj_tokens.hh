@@ -0,0 +1,35 @@
+#pragma once
+#include <charconv>
+#include <string_view>
+
+// In-place tokenizing of obj lines, shared by the whole-file and the streaming readers
+namespace tnp {
+
+inline bool is_blank(char c)
+{
+    return c == ' ' or c == '\t' or c == '\r' or c == '\v' or c == '\f';
+}
+
+// Splits the next blank separated token off [it, end), empty when the line is exhausted
+inline std::string_view next_token(const char*& it, const char* end)
+{
+    while(it != end and is_blank(*it))
+        ++it;
+    const char* begin = it;
+    while(it != end and not is_blank(*it))
+        ++it;
+    return std::string_view(begin, static_cast<size_t>(it - begin));
+}
+
+// Parses the whole token as a float, accepting the leading '+' std::stof accepts
+inline bool parse_float(std::string_view token, float& value)
+{
+    const char* first = token.data();
+    const char* last = token.data() + token.size();
+    if(first != last and *first == '+')
+        ++first;
+    const auto result = std::from_chars(first, last, value);
+    return result.ec == std::errc() and result.ptr == last;
+}
+
+} // namespace tnp
@@ -0,0 +1,263 @@
+#include "organized.hh"
+#include "ransac.hh"
+#include "color.hh"
+#include "parallel.hh"
+#include "profile.hh"
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+
+namespace RANSAC {
+    int organized_block = 10;
+    float organized_max_rms = 0.02f;
+    float organized_depth_noise = 0.0f;
+    float organized_discontinuity = 0.02f;
+    int organized_min_pixels = 800;
+
+    namespace {
+        // Largest RMS distance to the plane accepted for a cluster at this depth
+        double rms_limit(double depth) {
+            return organized_max_rms + organized_depth_noise * depth * depth;
+        }
+
+        // Sums of the points of a cluster, enough to fit its plane and merge it with another
+        struct PlaneStats {
+            Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+            Eigen::Matrix3d outer = Eigen::Matrix3d::Zero();
+            size_t count = 0;
+
+            void add(const Eigen::Vector3f &p) {
+                const Eigen::Vector3d q = p.cast<double>();
+                sum += q;
+                outer += q * q.transpose();
+                ++count;
+            }
+
+            void merge(const PlaneStats &other) {
+                sum += other.sum;
+                outer += other.outer;
+                count += other.count;
+            }
+
+            // Least-squares plane, mse is the mean squared distance of the points to it
+            void fit(Eigen::Vector3f &centroid, Eigen::Vector3f &normal, double &mse) const {
+                const Eigen::Vector3d mean = sum / static_cast<double>(count);
+                const Eigen::Matrix3d covariance = outer / static_cast<double>(count) - mean * mean.transpose();
+                Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+                solver.computeDirect(covariance);
+                centroid = mean.cast<float>();
+                normal = solver.eigenvectors().col(0).cast<float>().normalized();
+                mse = std::max(0.0, solver.eigenvalues()(0));
+            }
+
+            double mse() const {
+                Eigen::Vector3f centroid, normal;
+                double error;
+                fit(centroid, normal, error);
+                return error;
+            }
+
+            // Whether the points are close enough to their plane for a cluster at their depth
+            bool planar() const {
+                const double limit = rms_limit(sum.z() / static_cast<double>(count));
+                return mse() < limit * limit;
+            }
+        };
+
+        // Node of the clustering graph, merged nodes are replaced by a new one
+        struct Cluster {
+            PlaneStats stats;
+            std::vector<int> neighbors;
+            int cell = -1; // grid cell of an initial cluster
+            int parents[2] = {-1, -1}; // clusters merged into this one
+            bool alive = true;
+        };
+
+        // Two neighboring pixels lie on the same surface when their depths are close relative to the depth
+        bool continuous(const Eigen::Vector3f &a, const Eigen::Vector3f &b) {
+            return std::abs(a.z() - b.z()) <= organized_discontinuity * (std::abs(a.z()) + std::abs(b.z()));
+        }
+
+        void replace_neighbor(std::vector<int> &neighbors, int old_id, int new_id) {
+            neighbors.erase(std::remove(neighbors.begin(), neighbors.end(), old_id), neighbors.end());
+            if (new_id >= 0 and std::find(neighbors.begin(), neighbors.end(), new_id) == neighbors.end()) {
+                neighbors.push_back(new_id);
+            }
+        }
+    }
+
+    std::vector<OrganizedPlane> organized_planes(tnp::PointCloud &cloud, size_t width, size_t height) {
+        TNP_SCOPE("organized_planes");
+        std::vector<OrganizedPlane> result;
+        if (width == 0 or height == 0 or cloud.size() != width * height) return result;
+        if (not cloud.has_colors()) cloud.add_colors();
+        if (not cloud.has_labels()) cloud.add_labels();
+
+        // a plane is fit to every cell of the grid, cells missing more than half of their points or
+        // with a depth jump or a fitting error above the limit take no part in the clustering
+        const size_t block = static_cast<size_t>(std::max(2, organized_block));
+        const size_t cells_x = width / block, cells_y = height / block;
+        std::vector<PlaneStats> cell_stats(cells_x * cells_y);
+        std::vector<char> cell_valid(cells_x * cells_y, 0);
+        const unsigned workers = tnp::resolve_threads(threads);
+        tnp::parallel_for(cells_y, workers, [&](size_t cy) {
+            for (size_t cx = 0; cx < cells_x; ++cx) {
+                PlaneStats &stats = cell_stats[cy * cells_x + cx];
+                bool valid = true;
+                for (size_t v = cy * block; valid and v < (cy + 1) * block; ++v) {
+                    for (size_t u = cx * block; valid and u < (cx + 1) * block; ++u) {
+                        const Eigen::Vector3f p = cloud.point(v * width + u);
+                        if (not p.allFinite()) continue;
+                        const Eigen::Vector3f left = u > cx * block ? cloud.point(v * width + u - 1) : p;
+                        const Eigen::Vector3f up = v > cy * block ? cloud.point((v - 1) * width + u) : p;
+                        valid = (not left.allFinite() or continuous(p, left)) and (not up.allFinite() or continuous(p, up));
+                        stats.add(p);
+                    }
+                }
+                cell_valid[cy * cells_x + cx] = valid and 2 * stats.count >= block * block and stats.planar();
+            }
+        });
+
+        std::vector<Cluster> clusters;
+        std::vector<int> cell_cluster(cell_valid.size(), -1);
+        for (size_t c = 0; c < cell_valid.size(); ++c) {
+            if (not cell_valid[c]) continue;
+            cell_cluster[c] = static_cast<int>(clusters.size());
+            Cluster cluster;
+            cluster.stats = cell_stats[c];
+            cluster.cell = static_cast<int>(c);
+            clusters.push_back(std::move(cluster));
+        }
+        for (size_t c = 0; c < cell_valid.size(); ++c) {
+            if (cell_cluster[c] < 0) continue;
+            const size_t cx = c % cells_x, cy = c / cells_x;
+            for (const size_t other : {cx + 1 < cells_x ? c + 1 : c, cy + 1 < cells_y ? c + cells_x : c}) {
+                if (other == c or cell_cluster[other] < 0) continue;
+                clusters[cell_cluster[c]].neighbors.push_back(cell_cluster[other]);
+                clusters[cell_cluster[other]].neighbors.push_back(cell_cluster[c]);
+            }
+        }
+
+        // the cluster with the lowest error is merged with the neighbor that fits best with it, or
+        // leaves the graph when no merge stays within the limit. Ties go to the oldest cluster.
+        using Entry = std::pair<double, int>;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        for (size_t id = 0; id < clusters.size(); ++id) queue.emplace(clusters[id].stats.mse(), static_cast<int>(id));
+        std::vector<int> extracted;
+        while (not queue.empty()) {
+            const int v = queue.top().second;
+            queue.pop();
+            if (not clusters[v].alive) continue;
+            int best = -1;
+            double best_mse = std::numeric_limits<double>::infinity();
+            PlaneStats best_stats;
+            for (const int u : clusters[v].neighbors) {
+                PlaneStats merged = clusters[v].stats;
+                merged.merge(clusters[u].stats);
+                const double mse = merged.mse();
+                if (mse < best_mse or (mse == best_mse and u < best)) {
+                    best = u;
+                    best_mse = mse;
+                    best_stats = merged;
+                }
+            }
+            clusters[v].alive = false;
+            if (best >= 0 and best_stats.planar()) {
+                const int id = static_cast<int>(clusters.size());
+                Cluster merged;
+                merged.stats = best_stats;
+                merged.parents[0] = v;
+                merged.parents[1] = best;
+                for (const int side : {v, best}) {
+                    for (const int w : clusters[side].neighbors) {
+                        if (w == v or w == best) continue;
+                        replace_neighbor(clusters[w].neighbors, side, id);
+                        if (std::find(merged.neighbors.begin(), merged.neighbors.end(), w) == merged.neighbors.end()) {
+                            merged.neighbors.push_back(w);
+                        }
+                    }
+                }
+                clusters[best].alive = false;
+                clusters.push_back(std::move(merged));
+                queue.emplace(best_mse, id);
+                continue;
+            }
+            for (const int w : clusters[v].neighbors) replace_neighbor(clusters[w].neighbors, v, -1);
+            if (clusters[v].stats.count >= static_cast<size_t>(std::max(0, organized_min_pixels))) extracted.push_back(v);
+        }
+        std::stable_sort(extracted.begin(), extracted.end(), [&](int a, int b) {
+            return clusters[a].stats.count > clusters[b].stats.count;
+        });
+
+        // the planes are grown from the pixels of their cells to the neighboring pixels that fit them
+        std::vector<Eigen::Vector3f> centroids(extracted.size()), normals(extracted.size());
+        std::vector<int32_t> labels(cloud.size(), -1);
+        std::queue<size_t> frontier;
+        for (size_t p = 0; p < extracted.size(); ++p) {
+            double mse;
+            clusters[extracted[p]].stats.fit(centroids[p], normals[p], mse);
+            std::vector<int> pending{extracted[p]};
+            while (not pending.empty()) {
+                const Cluster &cluster = clusters[pending.back()];
+                pending.pop_back();
+                if (cluster.cell < 0) {
+                    pending.push_back(cluster.parents[0]);
+                    pending.push_back(cluster.parents[1]);
+                    continue;
+                }
+                const size_t cx = static_cast<size_t>(cluster.cell) % cells_x, cy = static_cast<size_t>(cluster.cell) / cells_x;
+                for (size_t v = cy * block; v < (cy + 1) * block; ++v) {
+                    for (size_t u = cx * block; u < (cx + 1) * block; ++u) {
+                        if (not cloud.point(v * width + u).allFinite()) continue;
+                        labels[v * width + u] = static_cast<int32_t>(p);
+                        frontier.push(v * width + u);
+                    }
+                }
+            }
+        }
+        const bool with_normals = cloud.has_normals();
+        while (not frontier.empty()) {
+            const size_t i = frontier.front();
+            frontier.pop();
+            const int32_t p = labels[i];
+            const size_t u = i % width, v = i / width;
+            for (const size_t j : {u > 0 ? i - 1 : i, u + 1 < width ? i + 1 : i, v > 0 ? i - width : i, v + 1 < height ? i + width : i}) {
+                if (j == i or labels[j] >= 0) continue;
+                const Eigen::Vector3f q = cloud.point(j);
+                if (not q.allFinite() or not continuous(cloud.point(i), q)) continue;
+                const double band = std::max<double>(dist_threshold, 3.0 * rms_limit(q.z()));
+                if (not (std::abs(normals[p].dot(q - centroids[p])) < band)) continue;
+                if (with_normals and std::abs(normals[p].dot(cloud.normal(j))) < align_threshold) continue;
+                labels[j] = p;
+                frontier.push(j);
+            }
+        }
+
+        // final planes from all their pixels
+        std::vector<PlaneStats> final_stats(extracted.size());
+        std::vector<Eigen::Vector3f> colors;
+        for (size_t p = 0; p < extracted.size(); ++p) colors.push_back(generate_color(static_cast<int>(p)));
+        for (size_t i = 0; i < labels.size(); ++i) {
+            cloud.set_label(i, labels[i]);
+            if (labels[i] < 0) continue;
+            final_stats[labels[i]].add(cloud.point(i));
+            cloud.set_color(i, colors[labels[i]]);
+        }
+        for (const PlaneStats &stats : final_stats) {
+            OrganizedPlane plane;
+            double mse;
+            stats.fit(plane.centroid, plane.normal, mse);
+            // facing the viewpoint at the origin
+            if (plane.normal.dot(plane.centroid) > 0.0f) plane.normal = -plane.normal;
+            plane.pixels = stats.count;
+            plane.rms = static_cast<float>(std::sqrt(mse));
+            result.push_back(plane);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <Eigen/Core>
+#include <point_cloud.hh>
+#include <vector>
+
+namespace RANSAC {
+    // Organized cloud parameters
+    extern int organized_block; // Side in pixels of the grid cells the clustering starts from
+    extern float organized_max_rms; // Largest RMS distance of the points of a cluster to its plane
+    extern float organized_depth_noise; // Growth of that distance with the squared depth, for the noise of depth sensors
+    extern float organized_discontinuity; // Relative depth jump between neighboring pixels that splits two surfaces
+    extern int organized_min_pixels; // Pixels a cluster needs to be kept as a plane
+
+    struct OrganizedPlane {
+        Eigen::Vector3f centroid;
+        Eigen::Vector3f normal;
+        size_t pixels; // points labeled with the plane
+        float rms; // RMS distance of those points to the plane
+    };
+
+    // Planes of an organized cloud, `width` x `height` points stored row by row as a depth camera
+    // sees them, points with a non-finite coordinate being missing. The grid is cut in cells of
+    // `organized_block` pixels that are fit a plane each, then neighboring clusters are merged
+    // lowest fitting error first as long as the merged plane stays within `organized_max_rms` +
+    // `organized_depth_noise` * depth^2 (Feng et al., agglomerative hierarchical clustering). The
+    // planes are then grown pixel by pixel over the points within `dist_threshold`, or 3 times that
+    // RMS limit at their depth when larger, whose normals, when present, are aligned.
+    // Every point gets the color and label of its plane, the planes come largest first.
+    // Nothing is extracted when the cloud does not hold width * height points.
+    std::vector<OrganizedPlane> organized_planes(tnp::PointCloud &cloud, size_t width, size_t height);
+}
@@ -0,0 +1,271 @@
+#pragma once
+#include <profile.hh>
+#include <random.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tnp {
+
+// Number of threads to use for a requested count, 0 or less means all hardware threads
+inline unsigned resolve_threads(int requested) {
+    if (requested > 0) return static_cast<unsigned>(requested);
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Persistent pool of one thread per hardware thread but the caller's, shared by every parallel
+// loop so none of them pays for starting threads. A loop over [0, count) gives every taking part
+// worker a contiguous range of it, a worker done with its range steals the back half of the
+// largest one left. One loop runs at a time; a loop started from inside a task runs serially.
+// The first exception a task throws stops the loop, run() waits for the workers to finish their
+// current task and rethrows it on the calling thread.
+class ThreadPool {
+public:
+    // Created on first use, its workers are joined when the process exits
+    static ThreadPool &instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &thread : threads_) thread.join();
+    }
+
+    // Workers including the calling thread
+    size_t size() const { return ranges_.size(); }
+
+    // Index of the calling thread, unique among the live and past threads: [1, size()) for the
+    // workers of the pool, 0 for the first other thread to ask and size(), size() + 1, ... for
+    // the next ones, so threads outside the pool never share scratch with the pool or each other
+    static size_t worker_index() {
+        size_t &index = current_worker();
+        if (index == unregistered) index = register_external();
+        return index;
+    }
+
+    template<typename Task>
+    void run(size_t count, unsigned threads, Task &task) {
+        const size_t workers = std::min({static_cast<size_t>(std::max(1u, threads)), count, size()});
+        if (workers <= 1 or in_loop()) {
+            for (size_t i = 0; i < count; ++i) task(i);
+            return;
+        }
+        std::lock_guard<std::mutex> loop(loop_mutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t w = 0; w < workers; ++w) {
+                std::lock_guard<std::mutex> range(ranges_[w].mutex);
+                ranges_[w].begin = count * w / workers;
+                ranges_[w].end = count * (w + 1) / workers;
+            }
+            invoke_ = [](void *context, size_t i) { (*static_cast<Task*>(context))(i); };
+            context_ = &task;
+            path_ = profile::current_path();
+            workers_ = workers;
+            pending_ = workers - 1;
+            error_ = nullptr;
+            cancelled_.store(false, std::memory_order_relaxed);
+            ++generation_;
+        }
+        wake_.notify_all();
+        {
+            const InLoop inside;
+            guarded_work(0);
+        }
+        // the task and its captures live on this stack frame until every worker is done with them
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&] { return pending_ == 0; });
+        if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+private:
+    // Part of the loop left to a worker, [begin, end)
+    struct Range {
+        std::mutex mutex;
+        size_t begin = 0, end = 0;
+    };
+
+    ThreadPool() : ranges_(std::max(1u, std::thread::hardware_concurrency())) {
+        for (size_t w = 1; w < ranges_.size(); ++w) threads_.emplace_back([this, w] { serve(w); });
+    }
+
+    static constexpr size_t unregistered = SIZE_MAX;
+
+    static size_t &current_worker() {
+        static thread_local size_t index = unregistered;
+        return index;
+    }
+
+    static size_t register_external() {
+        static std::atomic<size_t> registered{0};
+        const size_t n = registered.fetch_add(1, std::memory_order_relaxed);
+        return n == 0 ? 0 : instance().size() - 1 + n;
+    }
+
+    static bool &in_loop() {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    // Marks the calling thread as running tasks of the loop while alive
+    struct InLoop {
+        InLoop() { in_loop() = true; }
+        ~InLoop() { in_loop() = false; }
+        InLoop(const InLoop &) = delete;
+        InLoop &operator=(const InLoop &) = delete;
+    };
+
+    void serve(size_t index) {
+        current_worker() = index;
+        in_loop() = true;
+        size_t seen = 0;
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stop_ or generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+            if (index >= workers_) continue;
+            lock.unlock();
+            {
+                // the tasks are profiled as nested in the scope that started the loop
+                const profile::Adopt adopt(path_);
+                guarded_work(index);
+            }
+            lock.lock();
+            if (--pending_ == 0) done_.notify_one();
+        }
+    }
+
+    // Runs the tasks of its own range front to back, then of the ranges it steals
+    void work(size_t self) {
+        size_t i;
+        while (not cancelled_.load(std::memory_order_relaxed) and take(self, i)) invoke_(context_, i);
+    }
+
+    // work() keeping the first exception of the loop for run() and stopping the other workers
+    void guarded_work(size_t self) {
+        try {
+            work(self);
+        } catch (...) {
+            cancelled_.store(true, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (not error_) error_ = std::current_exception();
+        }
+    }
+
+    bool take(size_t self, size_t &i) {
+        {
+            std::lock_guard<std::mutex> lock(ranges_[self].mutex);
+            if (ranges_[self].begin < ranges_[self].end) {
+                i = ranges_[self].begin++;
+                return true;
+            }
+        }
+        size_t victim = self, largest = 0;
+        for (size_t w = 0; w < workers_; ++w) {
+            std::lock_guard<std::mutex> lock(ranges_[w].mutex);
+            if (ranges_[w].end - ranges_[w].begin > largest) {
+                largest = ranges_[w].end - ranges_[w].begin;
+                victim = w;
+            }
+        }
+        if (largest == 0) return false;
+        size_t begin = 0, end = 0;
+        {
+            std::lock_guard<std::mutex> lock(ranges_[victim].mutex);
+            const size_t left = ranges_[victim].end - ranges_[victim].begin;
+            if (left > 0) {
+                end = ranges_[victim].end;
+                begin = end - (left + 1) / 2;
+                ranges_[victim].end = begin;
+            }
+        }
+        // the range may have been emptied since it was measured, measured again without its lock held
+        if (begin == end) return take(self, i);
+        std::lock_guard<std::mutex> lock(ranges_[self].mutex);
+        ranges_[self].begin = begin + 1;
+        ranges_[self].end = end;
+        i = begin;
+        return true;
+    }
+
+    std::vector<Range> ranges_;
+    std::vector<std::thread> threads_;
+    std::mutex loop_mutex_; // one loop at a time
+    std::mutex mutex_;
+    std::condition_variable wake_, done_;
+    void (*invoke_)(void*, size_t) = nullptr;
+    void *context_ = nullptr;
+    profile::Path path_;
+    size_t workers_ = 0;
+    size_t pending_ = 0;
+    size_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_; // first exception thrown by a task of the loop
+    std::atomic<bool> cancelled_{false}; // set once a task threw, the workers take no more tasks
+};
+
+// Runs task(i) for every i in [0, count) on at most `threads` workers of the pool, the calling
+// thread being one of them. Which worker runs a task depends on timing, so results must only
+// depend on i for the loop to be reproducible.
+template<typename Task>
+void parallel_for(size_t count, unsigned threads, Task task) {
+    ThreadPool::instance().run(count, threads, task);
+}
+
+// Combines map(0), ..., map(count - 1) in index order, the values being computed in parallel.
+// The result does not depend on the thread count even when combine is not associative.
+template<typename T, typename Map, typename Combine>
+T parallel_reduce(size_t count, unsigned threads, T identity, Map map, Combine combine) {
+    std::vector<T> values(count, identity);
+    parallel_for(count, threads, [&](size_t i) { values[i] = map(i); });
+    for (auto &value : values) identity = combine(identity, value);
+    return identity;
+}
+
+// One T per worker of the pool, for scratch buffers reused by the tasks a worker runs. Threads
+// outside the pool get a T of their own, created from the initial value on their first call.
+template<typename T>
+class PerWorker {
+public:
+    explicit PerWorker(const T &value = T()) : value_(value), slots_(ThreadPool::instance().size(), value) {}
+    T &local() {
+        const size_t index = ThreadPool::worker_index();
+        if (index < slots_.size()) return slots_[index];
+        // the elements of an unordered_map stay in place when it grows
+        std::lock_guard<std::mutex> lock(mutex_);
+        return external_.try_emplace(index, value_).first->second;
+    }
+
+private:
+    T value_;
+    std::vector<T> slots_;
+    std::mutex mutex_;
+    std::unordered_map<size_t, T> external_;
+};
+
+// Random generator of the calling thread, stream worker_index() of a fixed seed. The draws depend
+// on which worker runs a task, reproducible loops keep one seeded generator per task instead.
+inline Rng &worker_rng() {
+    static thread_local Rng rng = Rng(0x5eed).stream(ThreadPool::worker_index());
+    return rng;
+}
+
+} // namespace tnp
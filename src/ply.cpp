@@ -0,0 +1,420 @@
+#include "ply.hh"
+
+#include <mapped_file.hh>
+#include <profile.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+namespace tnp {
+
+namespace {
+
+enum class PlyType { int8, uint8, int16, uint16, int32, uint32, float32, float64, invalid };
+
+PlyType parse_type(const std::string &name)
+{
+    if(name == "char" or name == "int8") return PlyType::int8;
+    if(name == "uchar" or name == "uint8") return PlyType::uint8;
+    if(name == "short" or name == "int16") return PlyType::int16;
+    if(name == "ushort" or name == "uint16") return PlyType::uint16;
+    if(name == "int" or name == "int32") return PlyType::int32;
+    if(name == "uint" or name == "uint32") return PlyType::uint32;
+    if(name == "float" or name == "float32") return PlyType::float32;
+    if(name == "double" or name == "float64") return PlyType::float64;
+    return PlyType::invalid;
+}
+
+size_t type_size(PlyType type)
+{
+    switch(type)
+    {
+        case PlyType::int8: case PlyType::uint8: return 1;
+        case PlyType::int16: case PlyType::uint16: return 2;
+        case PlyType::int32: case PlyType::uint32: case PlyType::float32: return 4;
+        case PlyType::float64: return 8;
+        default: return 0;
+    }
+}
+
+template<typename T>
+T read_as(const char *data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+double read_value(PlyType type, const char *data)
+{
+    switch(type)
+    {
+        case PlyType::int8: return read_as<int8_t>(data);
+        case PlyType::uint8: return read_as<uint8_t>(data);
+        case PlyType::int16: return read_as<int16_t>(data);
+        case PlyType::uint16: return read_as<uint16_t>(data);
+        case PlyType::int32: return read_as<int32_t>(data);
+        case PlyType::uint32: return read_as<uint32_t>(data);
+        case PlyType::float32: return read_as<float>(data);
+        case PlyType::float64: return read_as<double>(data);
+        default: return 0.0;
+    }
+}
+
+// Largest value of an integer color type, colors stored as floats are already in [0, 1]
+double color_scale(PlyType type)
+{
+    switch(type)
+    {
+        case PlyType::uint8: return 1.0 / 255.0;
+        case PlyType::uint16: return 1.0 / 65535.0;
+        default: return 1.0;
+    }
+}
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    size_t offset;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    size_t stride = 0;
+    bool has_list = false;
+    std::vector<PlyProperty> properties;
+
+    const PlyProperty *find(const char *name) const
+    {
+        for(const PlyProperty &property : properties)
+            if(property.name == name)
+                return &property;
+        return nullptr;
+    }
+};
+
+bool little_endian()
+{
+    const uint32_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+void ply_error(const std::string &filename, const std::string &message)
+{
+    std::cout << "Error: "
+        << "failed to read input ply file '"
+        << filename
+        << "', "
+        << message
+        << ", nothing loaded"
+        << std::endl;
+}
+
+// Copies one property of every vertex to dst, converted to T and scaled
+template<typename T>
+void read_column(const char *vertices, const PlyElement &vertex, const PlyProperty &property, double scale, T *dst)
+{
+    const char *src = vertices + property.offset;
+    if(property.type == PlyType::float32 and std::is_same<T, float>::value and scale == 1.0)
+    {
+        for(size_t i = 0; i < vertex.count; ++i, src += vertex.stride)
+            dst[i] = static_cast<T>(read_as<float>(src));
+        return;
+    }
+    for(size_t i = 0; i < vertex.count; ++i, src += vertex.stride)
+        dst[i] = static_cast<T>(read_value(property.type, src) * scale);
+}
+
+} // namespace
+
+bool load_ply(const std::string &filename, PointCloud &cloud)
+{
+    TNP_SCOPE("load_ply");
+    cloud.clear();
+    if(not little_endian())
+    {
+        ply_error(filename, "binary ply is only supported on little endian platforms");
+        return false;
+    }
+    MappedFile file(filename);
+    if(not file.is_open())
+    {
+        std::cout << "Error: "
+            << "failed to open input ply file '"
+            << filename
+            << "', file not found, nothing loaded"
+            << std::endl;
+        return false;
+    }
+    TNP_COUNT("bytes parsed", file.size());
+
+    // the header is ascii and ends with "end_header\n", the binary data follows
+    const char *header_end = nullptr;
+    for(const char *it = file.begin(); it < file.end(); )
+    {
+        const char *line_end = static_cast<const char*>(std::memchr(it, '\n', static_cast<size_t>(file.end() - it)));
+        if(line_end == nullptr)
+            break;
+        if(std::string(it, line_end).compare(0, 10, "end_header") == 0)
+        {
+            header_end = line_end + 1;
+            break;
+        }
+        it = line_end + 1;
+    }
+    if(header_end == nullptr or file.size() < 3 or std::memcmp(file.data(), "ply", 3) != 0)
+    {
+        ply_error(filename, "no ply header found");
+        return false;
+    }
+
+    std::istringstream header(std::string(file.begin(), header_end));
+    std::vector<PlyElement> elements;
+    std::string line;
+    while(std::getline(header, line))
+    {
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        if(keyword == "format")
+        {
+            std::string format;
+            tokens >> format;
+            if(format != "binary_little_endian")
+            {
+                ply_error(filename, "'" + format + "' format is not supported, binary_little_endian expected");
+                return false;
+            }
+        }
+        else if(keyword == "element")
+        {
+            PlyElement element;
+            tokens >> element.name >> element.count;
+            elements.push_back(element);
+        }
+        else if(keyword == "property" and not elements.empty())
+        {
+            PlyElement &element = elements.back();
+            std::string type;
+            tokens >> type;
+            if(type == "list")
+            {
+                element.has_list = true;
+                continue;
+            }
+            PlyProperty property{"", parse_type(type), element.stride};
+            tokens >> property.name;
+            if(property.type == PlyType::invalid)
+            {
+                ply_error(filename, "unknown property type '" + type + "'");
+                return false;
+            }
+            element.stride += type_size(property.type);
+            element.properties.push_back(property);
+        }
+    }
+
+    // elements stored before the vertices are skipped, which needs a fixed size
+    const char *data = header_end;
+    const PlyElement *vertex = nullptr;
+    for(const PlyElement &element : elements)
+    {
+        if(element.name == "vertex")
+        {
+            vertex = &element;
+            break;
+        }
+        if(element.has_list)
+        {
+            ply_error(filename, "element '" + element.name + "' with list properties stored before the vertices");
+            return false;
+        }
+        // counts are checked by division, a crafted one would overflow count * stride
+        if(element.stride > 0 and element.count > static_cast<size_t>(file.end() - data) / element.stride)
+        {
+            ply_error(filename, "file truncated, " + std::to_string(element.count) + " '" + element.name + "' elements expected");
+            return false;
+        }
+        data += element.count * element.stride;
+    }
+    if(vertex == nullptr or vertex->has_list)
+    {
+        ply_error(filename, "no vertex element with fixed size properties");
+        return false;
+    }
+    if(vertex->stride > 0 and vertex->count > static_cast<size_t>(file.end() - data) / vertex->stride)
+    {
+        ply_error(filename, "file truncated, " + std::to_string(vertex->count) + " vertices expected");
+        return false;
+    }
+    const PlyProperty *x = vertex->find("x"), *y = vertex->find("y"), *z = vertex->find("z");
+    if(x == nullptr or y == nullptr or z == nullptr)
+    {
+        ply_error(filename, "vertex positions not found");
+        return false;
+    }
+    if(vertex->count == 0)
+    {
+        std::cout << "Error:"
+            << "no points read from input ply file '"
+            << filename
+            << "'"
+            << std::endl;
+        return false;
+    }
+
+    const PlyProperty *nx = vertex->find("nx"), *ny = vertex->find("ny"), *nz = vertex->find("nz");
+    const PlyProperty *r = vertex->find("red"), *g = vertex->find("green"), *b = vertex->find("blue");
+    const PlyProperty *label = vertex->find("label");
+    const bool with_normals = nx and ny and nz;
+    const bool with_colors = r and g and b;
+    if(with_normals) cloud.add_normals();
+    if(with_colors) cloud.add_colors();
+    if(label) cloud.add_labels();
+    cloud.resize(vertex->count);
+
+    read_column(data, *vertex, *x, 1.0, cloud.x().data());
+    read_column(data, *vertex, *y, 1.0, cloud.y().data());
+    read_column(data, *vertex, *z, 1.0, cloud.z().data());
+    if(with_normals)
+    {
+        read_column(data, *vertex, *nx, 1.0, cloud.nx().data());
+        read_column(data, *vertex, *ny, 1.0, cloud.ny().data());
+        read_column(data, *vertex, *nz, 1.0, cloud.nz().data());
+    }
+    if(with_colors)
+    {
+        read_column(data, *vertex, *r, color_scale(r->type), cloud.r().data());
+        read_column(data, *vertex, *g, color_scale(g->type), cloud.g().data());
+        read_column(data, *vertex, *b, color_scale(b->type), cloud.b().data());
+    }
+    if(label)
+        read_column(data, *vertex, *label, 1.0, cloud.labels().data());
+
+    std::cout << "Loaded "
+        << cloud.size()
+        << " points from ply file '" << filename << "'";
+    if(with_normals and with_colors)
+        std::cout << " (with normals and colors)";
+    else if(with_normals)
+        std::cout << " (with normals)";
+    else if(with_colors)
+        std::cout << " (with colors)";
+    if(label)
+        std::cout << " (with labels)";
+    std::cout << std::endl;
+    return true;
+}
+
+void write_ply_header(std::ostream &os, size_t count, bool with_normals, bool with_colors, bool with_labels)
+{
+    os << "ply\n"
+        << "format binary_little_endian 1.0\n"
+        << "element vertex " << count << '\n'
+        << "property float x\nproperty float y\nproperty float z\n";
+    if(with_normals)
+        os << "property float nx\nproperty float ny\nproperty float nz\n";
+    if(with_colors)
+        os << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+    if(with_labels)
+        os << "property int label\n";
+    os << "end_header\n";
+}
+
+bool save_ply(const std::string &filename, const PointCloud &cloud)
+{
+    TNP_SCOPE("save_ply");
+    if(not little_endian())
+    {
+        std::cout << "Error: "
+            << "binary ply is only supported on little endian platforms, '"
+            << filename
+            << "' not saved"
+            << std::endl;
+        return false;
+    }
+    std::ofstream fs(filename, std::ios::binary);
+    if(not fs.is_open())
+    {
+        std::cout << "Error: "
+            << "failed to open output ply file '"
+            << filename
+            << "', nothing saved"
+            << std::endl;
+        return false;
+    }
+
+    write_ply_header(fs, cloud.size(), cloud.has_normals(), cloud.has_colors(), cloud.has_labels());
+
+    const size_t stride = 12 + (cloud.has_normals() ? 12 : 0) + (cloud.has_colors() ? 3 : 0) + (cloud.has_labels() ? 4 : 0);
+    // vertices are interleaved block by block and written with one call per block
+    constexpr size_t block_vertices = size_t(1) << 16;
+    std::vector<char> buffer(std::min(cloud.size(), block_vertices) * stride);
+    const float *columns[6] = {cloud.x().data(), cloud.y().data(), cloud.z().data(), cloud.nx().data(), cloud.ny().data(), cloud.nz().data()};
+    const size_t float_columns = cloud.has_normals() ? 6 : 3;
+    for(size_t begin = 0; begin < cloud.size() and fs; begin += block_vertices)
+    {
+        const size_t end = std::min(cloud.size(), begin + block_vertices);
+        char *out = buffer.data();
+        auto put = [&out](const void *value, size_t size)
+        {
+            std::memcpy(out, value, size);
+            out += size;
+        };
+        for(size_t i = begin; i < end; ++i)
+        {
+            for(size_t k = 0; k < float_columns; ++k)
+                put(&columns[k][i], 4);
+            if(cloud.has_colors())
+            {
+                const Eigen::Vector3f c = cloud.color(i);
+                for(int k = 0; k < 3; ++k)
+                {
+                    const uint8_t value = static_cast<uint8_t>(std::lround(std::min(1.0f, std::max(0.0f, c[k])) * 255.0f));
+                    put(&value, 1);
+                }
+            }
+            if(cloud.has_labels())
+            {
+                const int32_t value = cloud.label(i);
+                put(&value, 4);
+            }
+        }
+        fs.write(buffer.data(), static_cast<std::streamsize>(out - buffer.data()));
+    }
+    if(not fs)
+    {
+        std::cout << "Error: "
+            << "failed to write output ply file '"
+            << filename
+            << "'"
+            << std::endl;
+        return false;
+    }
+
+    std::cout << "Saved "
+        << cloud.size()
+        << " points to ply file '" << filename << "'";
+    if(cloud.has_normals() and cloud.has_colors())
+        std::cout << " (with normals and colors)";
+    else if(cloud.has_normals())
+        std::cout << " (with normals)";
+    else if(cloud.has_colors())
+        std::cout << " (with colors)";
+    if(cloud.has_labels())
+        std::cout << " (with labels)";
+    std::cout << std::endl;
+    return true;
+}
+
+} // namespace tnp
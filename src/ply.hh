@@ -0,0 +1,20 @@
+#pragma once
+#include <point_cloud.hh>
+
+#include <ostream>
+#include <string>
+
+namespace tnp {
+
+// Reads the vertex element of a binary little endian PLY file: x y z, nx ny nz,
+// red green blue (integers are scaled to [0, 1]) and an integer label property
+bool load_ply(const std::string &filename, PointCloud &cloud);
+
+// Writes a binary little endian PLY file with float positions and normals, uchar colors
+// and, when the cloud has labels, an int label property per vertex
+bool save_ply(const std::string &filename, const PointCloud &cloud);
+
+// Header written by save_ply, the vertices follow as x y z [nx ny nz] [red green blue] [label]
+void write_ply_header(std::ostream &os, size_t count, bool with_normals, bool with_colors, bool with_labels);
+
+} // namespace tnp
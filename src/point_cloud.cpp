@@ -0,0 +1,140 @@
+#include "point_cloud.hh"
+
+#include <profile.hh>
+
+namespace tnp {
+
+namespace {
+
+// Resizes or fills a buffer through `change`, recording the allocation when it had to grow
+template<typename Buffer, typename Change>
+void grow(Buffer &buffer, Change change)
+{
+    const size_t capacity = buffer.capacity();
+    change(buffer);
+    if(buffer.capacity() > capacity)
+        TNP_ALLOCATION(buffer.capacity() * sizeof(typename Buffer::value_type));
+}
+
+} // namespace
+
+PointCloud::PointCloud(
+    const std::vector<Eigen::Vector3f> &points,
+    const std::vector<Eigen::Vector3f> &normals,
+    const std::vector<Eigen::Vector3f> &colors)
+{
+    resize(points.size());
+    for(size_t i = 0; i < points.size(); ++i)
+        set_point(i, points[i]);
+    if(not normals.empty() and normals.size() == points.size())
+    {
+        add_normals();
+        for(size_t i = 0; i < normals.size(); ++i)
+            set_normal(i, normals[i]);
+    }
+    if(not colors.empty() and colors.size() == points.size())
+    {
+        add_colors();
+        for(size_t i = 0; i < colors.size(); ++i)
+            set_color(i, colors[i]);
+    }
+}
+
+void PointCloud::clear()
+{
+    for(Buffer* buffer : {&x_, &y_, &z_, &nx_, &ny_, &nz_, &r_, &g_, &b_})
+        buffer->clear();
+    labels_.clear();
+    with_normals_ = false;
+    with_colors_ = false;
+    with_labels_ = false;
+}
+
+void PointCloud::reserve(size_t n)
+{
+    const auto reserve = [n](auto &buffer) { buffer.reserve(n); };
+    for(Buffer* buffer : {&x_, &y_, &z_})
+        grow(*buffer, reserve);
+    if(has_normals())
+        for(Buffer* buffer : {&nx_, &ny_, &nz_})
+            grow(*buffer, reserve);
+    if(has_colors())
+        for(Buffer* buffer : {&r_, &g_, &b_})
+            grow(*buffer, reserve);
+    if(has_labels())
+        grow(labels_, reserve);
+}
+
+void PointCloud::resize(size_t n)
+{
+    for(Buffer* buffer : {&x_, &y_, &z_})
+        grow(*buffer, [n](Buffer &b) { b.resize(n); });
+    if(has_normals())
+        for(Buffer* buffer : {&nx_, &ny_, &nz_})
+            grow(*buffer, [n](Buffer &b) { b.resize(n); });
+    if(has_colors())
+        for(Buffer* buffer : {&r_, &g_, &b_})
+            grow(*buffer, [n](Buffer &b) { b.resize(n, 0.5f); });
+    if(has_labels())
+        grow(labels_, [n](LabelBuffer &b) { b.resize(n, -1); });
+}
+
+void PointCloud::add_normals(const Eigen::Vector3f &fill)
+{
+    grow(nx_, [&](Buffer &b) { b.assign(size(), fill.x()); });
+    grow(ny_, [&](Buffer &b) { b.assign(size(), fill.y()); });
+    grow(nz_, [&](Buffer &b) { b.assign(size(), fill.z()); });
+    with_normals_ = true;
+}
+
+void PointCloud::add_colors(const Eigen::Vector3f &fill)
+{
+    grow(r_, [&](Buffer &b) { b.assign(size(), fill.x()); });
+    grow(g_, [&](Buffer &b) { b.assign(size(), fill.y()); });
+    grow(b_, [&](Buffer &b) { b.assign(size(), fill.z()); });
+    with_colors_ = true;
+}
+
+void PointCloud::add_labels(int32_t fill)
+{
+    grow(labels_, [&](LabelBuffer &b) { b.assign(size(), fill); });
+    with_labels_ = true;
+}
+
+void PointCloud::remove_normals()
+{
+    for(Buffer* buffer : {&nx_, &ny_, &nz_})
+        Buffer().swap(*buffer);
+    with_normals_ = false;
+}
+
+void PointCloud::remove_colors()
+{
+    for(Buffer* buffer : {&r_, &g_, &b_})
+        Buffer().swap(*buffer);
+    with_colors_ = false;
+}
+
+void PointCloud::remove_labels()
+{
+    LabelBuffer().swap(labels_);
+    with_labels_ = false;
+}
+
+void PointCloud::to_vectors(
+    std::vector<Eigen::Vector3f> &points,
+    std::vector<Eigen::Vector3f> &normals,
+    std::vector<Eigen::Vector3f> &colors) const
+{
+    grow(points, [&](std::vector<Eigen::Vector3f> &v) { v.resize(size()); });
+    grow(normals, [&](std::vector<Eigen::Vector3f> &v) { v.resize(has_normals() ? size() : 0); });
+    grow(colors, [&](std::vector<Eigen::Vector3f> &v) { v.resize(has_colors() ? size() : 0); });
+    for(size_t i = 0; i < points.size(); ++i)
+        points[i] = point(i);
+    for(size_t i = 0; i < normals.size(); ++i)
+        normals[i] = normal(i);
+    for(size_t i = 0; i < colors.size(); ++i)
+        colors[i] = color(i);
+}
+
+} // namespace tnp
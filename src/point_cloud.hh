@@ -0,0 +1,94 @@
+#pragma once
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+
+namespace tnp {
+
+// Point cloud stored as a structure of arrays: every coordinate of the positions,
+// normals and colors lives in its own aligned buffer so loops can stream contiguous floats.
+// Points can also carry an integer label, the index of the plane they belong to or -1.
+class PointCloud {
+public:
+    using Buffer = std::vector<float, Eigen::aligned_allocator<float>>;
+    using Map = Eigen::Map<Eigen::VectorXf, Eigen::AlignedMax>;
+    using ConstMap = Eigen::Map<const Eigen::VectorXf, Eigen::AlignedMax>;
+    using LabelBuffer = std::vector<int32_t, Eigen::aligned_allocator<int32_t>>;
+    using LabelVector = Eigen::Matrix<int32_t, Eigen::Dynamic, 1>;
+    using LabelMap = Eigen::Map<LabelVector, Eigen::AlignedMax>;
+    using ConstLabelMap = Eigen::Map<const LabelVector, Eigen::AlignedMax>;
+
+    PointCloud() = default;
+    // Copies an array-of-structs cloud, normals and colors are kept only if they match the points size
+    PointCloud(const std::vector<Eigen::Vector3f> &points,
+               const std::vector<Eigen::Vector3f> &normals = {},
+               const std::vector<Eigen::Vector3f> &colors = {});
+
+    size_t size() const { return x_.size(); }
+    bool empty() const { return x_.empty(); }
+    bool has_normals() const { return with_normals_; }
+    bool has_colors() const { return with_colors_; }
+    bool has_labels() const { return with_labels_; }
+
+    void clear();
+    void reserve(size_t n);
+    // Resizes the positions and every attribute already present
+    void resize(size_t n);
+    // Attributes are sized to the current points and follow every later resize
+    void add_normals(const Eigen::Vector3f &fill = Eigen::Vector3f::Zero());
+    void add_colors(const Eigen::Vector3f &fill = Eigen::Vector3f(0.5f, 0.5f, 0.5f));
+    void add_labels(int32_t fill = -1);
+    void remove_normals();
+    void remove_colors();
+    void remove_labels();
+
+    Eigen::Vector3f point(size_t i) const { return {x_[i], y_[i], z_[i]}; }
+    Eigen::Vector3f normal(size_t i) const { return {nx_[i], ny_[i], nz_[i]}; }
+    Eigen::Vector3f color(size_t i) const { return {r_[i], g_[i], b_[i]}; }
+    int32_t label(size_t i) const { return labels_[i]; }
+    void set_point(size_t i, const Eigen::Vector3f &p) { x_[i] = p.x(); y_[i] = p.y(); z_[i] = p.z(); }
+    void set_normal(size_t i, const Eigen::Vector3f &n) { nx_[i] = n.x(); ny_[i] = n.y(); nz_[i] = n.z(); }
+    void set_color(size_t i, const Eigen::Vector3f &c) { r_[i] = c.x(); g_[i] = c.y(); b_[i] = c.z(); }
+    void set_label(size_t i, int32_t l) { labels_[i] = l; }
+
+    // Views over the coordinate arrays, attribute views are empty when the attribute is absent
+    Map x() { return map(x_); }
+    Map y() { return map(y_); }
+    Map z() { return map(z_); }
+    Map nx() { return map(nx_); }
+    Map ny() { return map(ny_); }
+    Map nz() { return map(nz_); }
+    Map r() { return map(r_); }
+    Map g() { return map(g_); }
+    Map b() { return map(b_); }
+    LabelMap labels() { return LabelMap(labels_.data(), static_cast<Eigen::Index>(labels_.size())); }
+    ConstMap x() const { return map(x_); }
+    ConstMap y() const { return map(y_); }
+    ConstMap z() const { return map(z_); }
+    ConstMap nx() const { return map(nx_); }
+    ConstMap ny() const { return map(ny_); }
+    ConstMap nz() const { return map(nz_); }
+    ConstMap r() const { return map(r_); }
+    ConstMap g() const { return map(g_); }
+    ConstMap b() const { return map(b_); }
+    ConstLabelMap labels() const { return ConstLabelMap(labels_.data(), static_cast<Eigen::Index>(labels_.size())); }
+
+    // Copies back to array-of-structs, absent attributes give empty vectors
+    void to_vectors(std::vector<Eigen::Vector3f> &points,
+                    std::vector<Eigen::Vector3f> &normals,
+                    std::vector<Eigen::Vector3f> &colors) const;
+
+private:
+    static Map map(Buffer &buffer) { return Map(buffer.data(), static_cast<Eigen::Index>(buffer.size())); }
+    static ConstMap map(const Buffer &buffer) { return ConstMap(buffer.data(), static_cast<Eigen::Index>(buffer.size())); }
+
+    Buffer x_, y_, z_;
+    Buffer nx_, ny_, nz_;
+    Buffer r_, g_, b_;
+    LabelBuffer labels_;
+    bool with_normals_ = false;
+    bool with_colors_ = false;
+    bool with_labels_ = false;
+};
+
+} // namespace tnp
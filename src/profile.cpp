@@ -0,0 +1,414 @@
+#include "profile.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <ostream>
+
+namespace tnp {
+namespace profile {
+
+namespace {
+
+std::mutex &trace_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::string &trace_file()
+{
+    static std::string filename = [] {
+        const char *env = std::getenv("RANSAC_TRACE");
+        return std::string(env != nullptr ? env : "");
+    }();
+    return filename;
+}
+
+// Whether scopes and counters are recorded as trace events
+std::atomic<bool> &tracing()
+{
+    static std::atomic<bool> flag(not trace_file().empty());
+    return flag;
+}
+
+} // namespace
+
+void set_trace_file(const std::string &filename)
+{
+    std::lock_guard<std::mutex> lock(trace_mutex());
+    trace_file() = filename;
+    tracing() = not filename.empty();
+}
+
+#ifdef RANSAC_PROFILE
+
+namespace {
+
+struct Counter {
+    const char *name;
+    double samples = 0.0, total = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void add(double value)
+    {
+        samples += 1.0;
+        total += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    void merge(const Counter &other)
+    {
+        samples += other.samples;
+        total += other.total;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+// Scope of the per thread call tree, a scope entered from different places gets a node per place
+struct Node {
+    Node(const char *name, int parent) : name(name), parent(parent) {}
+
+    const char *name;
+    int parent;
+    double calls = 0.0, seconds = 0.0, allocations = 0.0, bytes = 0.0;
+    std::vector<int> children;
+    std::vector<Counter> counters;
+};
+
+// Complete ('X') or counter ('C') trace event
+struct Event {
+    const char *name;
+    double start, value; // value is the duration of a scope, in microseconds
+    bool counter;
+};
+
+// A thread that traced more events than this only keeps its first ones
+constexpr size_t max_events = size_t(1) << 20;
+
+struct ThreadData {
+    size_t id;
+    std::vector<Node> nodes{Node("", -1)};
+    int current = 0;
+    std::vector<Event> events;
+    size_t dropped = 0;
+};
+
+// Every thread that recorded something, kept until the process ends so a report still sees the
+// threads that are gone
+std::vector<ThreadData *> &registry()
+{
+    static std::vector<ThreadData *> *threads = new std::vector<ThreadData *>;
+    return *threads;
+}
+
+std::mutex &registry_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+ThreadData &local()
+{
+    static thread_local ThreadData *data = [] {
+        ThreadData *created = new ThreadData;
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        created->id = registry().size();
+        registry().push_back(created);
+        return created;
+    }();
+    return *data;
+}
+
+// Microseconds since the first timestamp of the process
+double now()
+{
+    using Clock = std::chrono::steady_clock;
+    static const Clock::time_point origin = Clock::now();
+    return std::chrono::duration<double, std::micro>(Clock::now() - origin).count();
+}
+
+int child(ThreadData &data, int parent, const char *name)
+{
+    for(const int c : data.nodes[parent].children)
+    {
+        if(data.nodes[c].name == name)
+            return c;
+    }
+    const int created = static_cast<int>(data.nodes.size());
+    data.nodes.emplace_back(name, parent);
+    data.nodes[parent].children.push_back(created);
+    return created;
+}
+
+void record(ThreadData &data, const Event &event)
+{
+    if(not tracing().load(std::memory_order_relaxed))
+        return;
+    if(data.events.size() < max_events)
+        data.events.push_back(event);
+    else
+        ++data.dropped;
+}
+
+// Scopes of every thread merged by name path
+struct Merged {
+    std::string name;
+    double calls = 0.0, seconds = 0.0, allocations = 0.0, bytes = 0.0;
+    std::vector<Counter> counters;
+    std::vector<std::string> counter_names;
+    std::vector<Merged> children;
+
+    void merge(const ThreadData &data, const Node &node)
+    {
+        calls += node.calls;
+        seconds += node.seconds;
+        allocations += node.allocations;
+        bytes += node.bytes;
+        for(const Counter &counter : node.counters)
+        {
+            const auto found = std::find(counter_names.begin(), counter_names.end(), counter.name);
+            if(found == counter_names.end())
+            {
+                counter_names.push_back(counter.name);
+                counters.push_back(counter);
+            }
+            else
+                counters[found - counter_names.begin()].merge(counter);
+        }
+        for(const int c : node.children)
+        {
+            const Node &sub = data.nodes[c];
+            auto found = std::find_if(children.begin(), children.end(), [&](const Merged &m) { return m.name == sub.name; });
+            if(found == children.end())
+            {
+                children.push_back(Merged());
+                children.back().name = sub.name;
+                found = children.end() - 1;
+            }
+            found->merge(data, sub);
+        }
+    }
+
+    // Allocations of the scope and of the scopes nested in it
+    void totals(double &allocs, double &allocated) const
+    {
+        allocs += allocations;
+        allocated += bytes;
+        for(const Merged &c : children)
+            c.totals(allocs, allocated);
+    }
+};
+
+void print(std::ostream &out, const Merged &node, int depth)
+{
+    const std::string indent(static_cast<size_t>(2 * depth), ' ');
+    double child_seconds = 0.0;
+    for(const Merged &c : node.children)
+        child_seconds += c.seconds;
+    double allocs = 0.0, allocated = 0.0;
+    node.totals(allocs, allocated);
+    out << std::left << std::setw(40) << (indent + node.name) << std::right
+        << std::setw(10) << std::setprecision(0) << node.calls
+        << std::setw(12) << std::setprecision(3) << node.seconds * 1e3
+        << std::setw(12) << std::max(0.0, node.seconds - child_seconds) * 1e3
+        << std::setw(10) << std::setprecision(0) << allocs
+        << std::setw(12) << std::setprecision(3) << allocated / (1024.0 * 1024.0) << '\n';
+    for(size_t c = 0; c < node.counters.size(); ++c)
+    {
+        const Counter &counter = node.counters[c];
+        out << std::left << std::setw(40) << (indent + "  # " + node.counter_names[c]) << std::right
+            << std::setw(10) << std::setprecision(0) << counter.samples
+            << "  total " << std::setprecision(0) << counter.total
+            << ", mean " << std::setprecision(1) << counter.total / counter.samples
+            << ", min " << std::setprecision(0) << counter.min
+            << ", max " << counter.max << '\n';
+    }
+    for(const Merged &c : node.children)
+        print(out, c, depth + 1);
+}
+
+void write_string(std::ostream &out, const char *text)
+{
+    out << '"';
+    for(const char *c = text; *c != '\0'; ++c)
+    {
+        if(*c == '"' or *c == '\\')
+            out << '\\';
+        out << *c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+Scope::Scope(const char *name)
+{
+    ThreadData &data = local();
+    data.current = child(data, data.current, name);
+    start_ = now();
+}
+
+Scope::~Scope()
+{
+    const double end = now();
+    ThreadData &data = local();
+    Node &node = data.nodes[data.current];
+    node.calls += 1.0;
+    node.seconds += (end - start_) * 1e-6;
+    record(data, Event{node.name, start_, end - start_, false});
+    data.current = node.parent;
+}
+
+void count(const char *name, double value)
+{
+    ThreadData &data = local();
+    std::vector<Counter> &counters = data.nodes[data.current].counters;
+    auto found = std::find_if(counters.begin(), counters.end(), [&](const Counter &c) { return c.name == name; });
+    if(found == counters.end())
+    {
+        counters.push_back(Counter{name});
+        found = counters.end() - 1;
+    }
+    found->add(value);
+    record(data, Event{name, now(), value, true});
+}
+
+void allocation(double bytes)
+{
+    ThreadData &data = local();
+    data.nodes[data.current].allocations += 1.0;
+    data.nodes[data.current].bytes += bytes;
+}
+
+Path current_path()
+{
+    const ThreadData &data = local();
+    Path path;
+    for(int n = data.current; n > 0; n = data.nodes[n].parent)
+        path.push_back(data.nodes[n].name);
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+Adopt::Adopt(const Path &path)
+{
+    ThreadData &data = local();
+    previous_ = data.current;
+    int node = 0;
+    for(const char *name : path)
+        node = child(data, node, name);
+    data.current = node;
+}
+
+Adopt::~Adopt()
+{
+    local().current = previous_;
+}
+
+void report(std::ostream &out)
+{
+    Merged root;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for(const ThreadData *data : registry())
+            root.merge(*data, data->nodes[0]);
+    }
+    if(root.children.empty() and root.counters.empty())
+        return;
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << "\nProfile, times summed over the threads\n"
+        << std::left << std::setw(40) << "scope" << std::right << std::setw(10) << "calls" << std::setw(12) << "total ms"
+        << std::setw(12) << "self ms" << std::setw(10) << "allocs" << std::setw(12) << "alloc MB" << '\n';
+    for(const Merged &c : root.children)
+        print(out, c, 0);
+    for(size_t c = 0; c < root.counters.size(); ++c)
+    {
+        out << std::left << std::setw(40) << ("# " + root.counter_names[c]) << std::right
+            << std::setw(10) << std::setprecision(0) << root.counters[c].samples
+            << "  total " << root.counters[c].total << '\n';
+    }
+    out << std::flush;
+    out.flags(flags);
+    out.precision(precision);
+}
+
+bool write_trace(const std::string &filename)
+{
+    std::ofstream out(filename);
+    if(not out)
+    {
+        std::cout << "Error: failed to open trace file '" << filename << "'" << std::endl;
+        return false;
+    }
+    out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    size_t dropped = 0;
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    for(const ThreadData *data : registry())
+    {
+        out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << data->id
+            << ", \"args\": {\"name\": \"thread " << data->id << "\"}}";
+        first = false;
+        for(const Event &event : data->events)
+        {
+            out << ",\n{\"name\": ";
+            write_string(out, event.name);
+            if(event.counter)
+                out << ", \"ph\": \"C\", \"ts\": " << event.start << ", \"pid\": 1, \"tid\": " << data->id
+                    << ", \"args\": {\"value\": " << event.value << "}}";
+            else
+                out << ", \"ph\": \"X\", \"ts\": " << event.start << ", \"dur\": " << event.value
+                    << ", \"pid\": 1, \"tid\": " << data->id << "}";
+        }
+        dropped += data->dropped;
+    }
+    out << "\n]}\n";
+    if(dropped > 0)
+        std::cout << "Warning: " << dropped << " trace events past the first " << max_events << " of a thread were dropped" << std::endl;
+    if(not out)
+    {
+        std::cout << "Error: failed to write trace file '" << filename << "'" << std::endl;
+        return false;
+    }
+    std::cout << "Saved trace to '" << filename << "'" << std::endl;
+    return true;
+}
+
+#else
+
+void report(std::ostream &)
+{
+}
+
+bool write_trace(const std::string &)
+{
+    return false;
+}
+
+#endif
+
+void end_run(std::ostream &out)
+{
+    report(out);
+    std::string filename;
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex());
+        filename = trace_file();
+    }
+    if(enabled and not filename.empty())
+        write_trace(filename);
+}
+
+} // namespace profile
+} // namespace tnp
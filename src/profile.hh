@@ -0,0 +1,88 @@
+#pragma once
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Scoped timers and counters, compiled in when RANSAC_PROFILE is defined and expanding to nothing
+// otherwise. Scopes nest per thread, the tasks of a parallel loop being nested in the scope that
+// started it, and counters belong to the innermost open scope. A run ends with end_run(), which
+// prints the summary table and, when a trace file is set (RANSAC_TRACE in the environment), writes
+// the scopes and counters as Chrome trace events that Perfetto or chrome://tracing can open.
+
+#ifdef RANSAC_PROFILE
+#define TNP_PROFILE_JOIN2(a, b) a##b
+#define TNP_PROFILE_JOIN(a, b) TNP_PROFILE_JOIN2(a, b)
+// Times the rest of the enclosing block, `name` must be a string literal
+#define TNP_SCOPE(name) const ::tnp::profile::Scope TNP_PROFILE_JOIN(tnp_profile_scope_, __LINE__)(name)
+// Adds a sample to the counter `name` of the current scope: count, total, min and max are reported
+#define TNP_COUNT(name, value) ::tnp::profile::count(name, static_cast<double>(value))
+// Records an allocation of `bytes` made in the current scope
+#define TNP_ALLOCATION(bytes) ::tnp::profile::allocation(static_cast<double>(bytes))
+#else
+// the arguments are not evaluated, only named so that the variables they use stay used
+#define TNP_SCOPE(name) static_cast<void>(sizeof(name))
+#define TNP_COUNT(name, value) static_cast<void>(sizeof(name) + sizeof(value))
+#define TNP_ALLOCATION(bytes) static_cast<void>(sizeof(bytes))
+#endif
+
+namespace tnp {
+namespace profile {
+
+#ifdef RANSAC_PROFILE
+constexpr bool enabled = true;
+
+class Scope {
+public:
+    explicit Scope(const char *name);
+    ~Scope();
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    double start_;
+};
+
+void count(const char *name, double value);
+void allocation(double bytes);
+
+// Names of the scopes open on the calling thread, outermost first
+using Path = std::vector<const char *>;
+Path current_path();
+
+// Nests the scopes of the calling thread in `path` while it lives, for the workers of a parallel loop
+class Adopt {
+public:
+    explicit Adopt(const Path &path);
+    ~Adopt();
+    Adopt(const Adopt &) = delete;
+    Adopt &operator=(const Adopt &) = delete;
+
+private:
+    int previous_;
+};
+#else
+constexpr bool enabled = false;
+
+struct Path {};
+inline Path current_path() { return {}; }
+struct Adopt {
+    explicit Adopt(const Path &) {}
+};
+#endif
+
+// Trace file written by end_run, empty for none. Defaults to the RANSAC_TRACE environment variable.
+void set_trace_file(const std::string &filename);
+
+// Summary table of the scopes and counters of every thread, nothing when profiling is compiled
+// out. Must not be called while a parallel loop runs.
+void report(std::ostream &out);
+
+// Chrome trace event JSON of the recorded scopes and counters, false when it cannot be written
+// or profiling is compiled out
+bool write_trace(const std::string &filename);
+
+// Prints the report and writes the trace file if one is set
+void end_run(std::ostream &out);
+
+} // namespace profile
+} // namespace tnp
@@ -0,0 +1,145 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <random>
+
+namespace tnp {
+
+// Seed of a sub-task, such as one plane of a run, derived from the seed of the whole task and a key
+inline uint64_t mix_seed(uint64_t seed, uint64_t key) {
+    // splitmix64 finalizer of the seed offset by the scrambled key
+    uint64_t z = seed + (key + 1) * 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Seed for the runs that do not ask for a fixed one: std::random_device is read once per process,
+// later seeds are derived from it and a counter, so they differ without a system call each
+inline uint64_t random_seed() {
+    static const uint64_t entropy = (static_cast<uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}();
+    static std::atomic<uint64_t> drawn{0};
+    return mix_seed(entropy, drawn.fetch_add(1, std::memory_order_relaxed));
+}
+
+// xoshiro256** of Blackman and Vigna: 32 bytes of state, seeded in a few operations, and a jump()
+// that splits the sequence in streams of 2^128 draws that never overlap. The integer, float and
+// gaussian draws are computed here rather than by the std distributions, whose algorithms differ
+// between standard libraries, so a seed gives the same numbers everywhere.
+class Rng {
+public:
+    using result_type = uint64_t;
+
+    // State filled by splitmix64 from the seed, so close seeds still give unrelated sequences
+    explicit Rng(uint64_t seed = 0) {
+        for (uint64_t &word : s_) {
+            seed += 0x9e3779b97f4a7c15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    result_type operator()() {
+        const uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        const uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+        return result;
+    }
+
+    // Advances by 2^128 draws, the generators of parallel tasks are one jump apart
+    void jump() {
+        static constexpr uint64_t polynomial[] = {0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull,
+                                                  0xa9582618e03fc9aaull, 0x39abdc4529b1661cull};
+        uint64_t s[4] = {0, 0, 0, 0};
+        for (const uint64_t word : polynomial) {
+            for (int b = 0; b < 64; ++b) {
+                if (word & (uint64_t(1) << b)) {
+                    for (int i = 0; i < 4; ++i) s[i] ^= s_[i];
+                }
+                (*this)();
+            }
+        }
+        for (int i = 0; i < 4; ++i) s_[i] = s[i];
+    }
+
+    // Stream `index` of this generator, a copy jumped `index` times
+    Rng stream(uint64_t index) const {
+        Rng copy = *this;
+        for (uint64_t i = 0; i < index; ++i) copy.jump();
+        return copy;
+    }
+
+    // Uniform in [0, n), n > 0, by Lemire's multiply and reject method
+    uint64_t below(uint64_t n) {
+        uint64_t low;
+        uint64_t high = multiply((*this)(), n, low);
+        if (low < n) {
+            const uint64_t threshold = (0 - n) % n;
+            while (low < threshold) high = multiply((*this)(), n, low);
+        }
+        return high;
+    }
+
+    // Uniform in [0, 1)
+    float uniform() { return static_cast<float>((*this)() >> 40) * 0x1.0p-24f; }
+    double uniform_double() { return static_cast<double>((*this)() >> 11) * 0x1.0p-53; }
+    // Uniform in [lo, hi)
+    float uniform(float lo, float hi) { return lo + (hi - lo) * uniform(); }
+
+    // Standard normal by Marsaglia's polar method, the second value of a pair is dropped
+    float normal() {
+        double u, v, s;
+        do {
+            u = 2.0 * uniform_double() - 1.0;
+            v = 2.0 * uniform_double() - 1.0;
+            s = u * u + v * v;
+        } while (s >= 1.0 or s == 0.0);
+        return static_cast<float>(u * std::sqrt(-2.0 * std::log(s) / s));
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    // High 64 bits of the 128 bit product a * b, its low 64 bits in `low`
+    static uint64_t multiply(uint64_t a, uint64_t b, uint64_t &low) {
+#ifdef __SIZEOF_INT128__
+        const unsigned __int128 m = static_cast<unsigned __int128>(a) * b;
+        low = static_cast<uint64_t>(m);
+        return static_cast<uint64_t>(m >> 64);
+#else
+        // schoolbook product of the 32 bit halves, the middle terms summed without overflow
+        const uint64_t a_lo = a & 0xffffffffu, a_hi = a >> 32;
+        const uint64_t b_lo = b & 0xffffffffu, b_hi = b >> 32;
+        const uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+        const uint64_t middle = (lo_lo >> 32) + (hi_lo & 0xffffffffu) + lo_hi;
+        low = (middle << 32) | (lo_lo & 0xffffffffu);
+        return hi_hi + (hi_lo >> 32) + (middle >> 32);
+#endif
+    }
+
+    uint64_t s_[4];
+};
+
+// Fisher-Yates shuffle with Rng::below, std::shuffle draws differently in each standard library
+template<typename Iterator>
+void shuffle(Iterator first, Iterator last, Rng &rng) {
+    for (auto n = std::distance(first, last); n > 1; --n) {
+        std::iter_swap(first + (n - 1), first + static_cast<std::ptrdiff_t>(rng.below(static_cast<uint64_t>(n))));
+    }
+}
+
+} // namespace tnp
@@ -1,11 +1,40 @@
 #include "ransac.hh"
 #include "color.hh"
+#include "inlier_kernel.hh"
+#include "parallel.hh"
+#include "profile.hh"
+#include "cloud_stream.hh"
+#include "voxel_grid.hh"
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 namespace RANSAC {
 // Function to estimate a plane from three points
     int iterations = 2000; // Number of iterations
     float dist_threshold = 0.3f; // Distance threshold for inliers
     float align_threshold = 0.9f;
     float pointsleft = 0.25f;
+    int threads = 0; // 0 = all hardware threads
+    uint64_t seed = 0; // 0 = a different seed for every run
+    float confidence = 0.0f; // 0 = always run all iterations
+    bool sprt = false;
+    int batch_size = 0; // 0 = score hypotheses one by one
+    bool octree_sampling = false;
+    int octree_depth = 8;
+    int preemption_block = 100;
+    int block_budget = 0; // 0 = no limit
+    double time_budget = 0.0; // 0 = no deadline
+    int stream_chunk = 1 << 20;
+    int stream_sample = 1 << 20;
+    int stream_candidates = 8;
+    float voxel_size = 0.0f; // 0 = full resolution
+    size_t downsampled_size = 0;
+    int pyramid_levels = 1;
+    std::vector<int> iterations_used;
     
     void estimate_plane(const Eigen::Vector3f &p1, const Eigen::Vector3f &p2, const Eigen::Vector3f &p3, 
                         Eigen::Vector3f &centroid, Eigen::Vector3f &normal) {
@@ -23,173 +52,1090 @@ namespace RANSAC {
         return std::abs(normal.dot(point - centroid));
     }
 
-    std::vector<Eigen::Vector3f> select_3_random_points(std::vector<Eigen::Vector3f> points, std::vector<size_t> remaining_idx){
-        std::vector<Eigen::Vector3f> random_points;
-        std::random_device rd;
-        std::mt19937 rng(rd());
-        std::uniform_int_distribution<> dist(0, remaining_idx.size()-1);
-        
-        for(int i = 0; i < 3; ++i) {
-            Eigen::Vector3f p = points[remaining_idx[dist(rng)]];
-            if (std::find(random_points.begin(), random_points.end(), p) == random_points.end()){
-                random_points.push_back(p);
+    std::array<size_t, 3> select_3_random_points(size_t count, tnp::Rng &rng){
+        // draw from a shrinking range and shift past the already drawn positions,
+        // so the three positions are distinct without any retry or allocation
+        size_t a = rng.below(count);
+        size_t b = rng.below(count - 1);
+        if (b >= a) ++b;
+        size_t c = rng.below(count - 2);
+        if (c >= std::min(a, b)) ++c;
+        if (c >= std::max(a, b)) ++c;
+        return {a, b, c};
+    }
+
+    std::array<size_t, 3> select_3_random_points(IndexSpan remaining, tnp::Rng &rng){
+        const auto sample = select_3_random_points(remaining.size, rng);
+        return {remaining.data[sample[0]], remaining.data[sample[1]], remaining.data[sample[2]]};
+    }
+
+    float calculate_alignement(const Eigen::Vector3f &normal1, const Eigen::Vector3f &normal2) {
+        return std::abs(normal1.dot(normal2));
+    }
+
+    namespace {
+        // Contiguous copy of the remaining points, so scoring streams floats instead of chasing indices
+        struct WorkingSet {
+            tnp::PointCloud::Buffer x, y, z, nx, ny, nz;
+        };
+
+        // Gives std::vector clouds the accessors of tnp::PointCloud
+        struct VectorCloud {
+            const std::vector<Eigen::Vector3f> &points;
+            const std::vector<Eigen::Vector3f> &normals;
+            std::vector<Eigen::Vector3f> &colors;
+
+            size_t size() const { return points.size(); }
+            bool has_normals() const { return not normals.empty() and normals.size() == points.size(); }
+            Eigen::Vector3f point(size_t i) const { return points[i]; }
+            Eigen::Vector3f normal(size_t i) const { return normals[i]; }
+            void set_color(size_t i, const Eigen::Vector3f &color) { colors[i] = color; }
+            void set_label(size_t, int32_t) {}
+        };
+
+        // Point clouds get a color per plane and a label per point, -1 until the point is extracted
+        void prepare(tnp::PointCloud &cloud) {
+            if (not cloud.has_colors()) cloud.add_colors();
+            if (not cloud.has_labels()) cloud.add_labels();
+        }
+
+        // Resizes a working set buffer, recording the allocation when it had to grow
+        void resize_buffer(tnp::PointCloud::Buffer &buffer, size_t size) {
+            const size_t capacity = buffer.capacity();
+            buffer.resize(size);
+            if (buffer.capacity() > capacity) TNP_ALLOCATION(buffer.capacity() * sizeof(float));
+        }
+
+        template<typename Cloud>
+        PointsView gather(const Cloud &cloud, IndexSpan remaining, bool with_normals, WorkingSet &ws) {
+            TNP_SCOPE("gather");
+            resize_buffer(ws.x, remaining.size);
+            resize_buffer(ws.y, remaining.size);
+            resize_buffer(ws.z, remaining.size);
+            for (size_t k = 0; k < remaining.size; ++k) {
+                const Eigen::Vector3f p = cloud.point(remaining.data[k]);
+                ws.x[k] = p.x(); ws.y[k] = p.y(); ws.z[k] = p.z();
+            }
+            PointsView view{ws.x.data(), ws.y.data(), ws.z.data()};
+            view.size = remaining.size;
+            if (with_normals) {
+                resize_buffer(ws.nx, remaining.size);
+                resize_buffer(ws.ny, remaining.size);
+                resize_buffer(ws.nz, remaining.size);
+                for (size_t k = 0; k < remaining.size; ++k) {
+                    const Eigen::Vector3f n = cloud.normal(remaining.data[k]);
+                    ws.nx[k] = n.x(); ws.ny[k] = n.y(); ws.nz[k] = n.z();
+                }
+                view.nx = ws.nx.data(); view.ny = ws.ny.data(); view.nz = ws.nz.data();
             }
+            return view;
         }
-        return random_points;
-    }
 
-    void simple_ransac(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors) {
-        // Initialize a pseudo-random generator with a random seed
-        std::random_device rd;
-        std::mt19937 rng(rd());
-        std::uniform_int_distribution<int> dist(0, points.size() - 1);
-        // inlier = point in our model  
-        int best_inlier_count = 0;
-        Eigen::Vector3f best_point, best_normal;
+        // Same test as point_to_plane_distance and calculate_alignement, written on the flat arrays
+        // with the x + (y + z) order of Eigen's dot product so the rounding is the same
+        inline bool is_inlier(const PointsView &pts, size_t i, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal, float threshold) {
+            const float dist = std::abs(normal.x() * (pts.x[i] - centroid.x()) + (normal.y() * (pts.y[i] - centroid.y()) + normal.z() * (pts.z[i] - centroid.z())));
+            bool inlier = dist < threshold;
+            if (pts.nx) {
+                inlier &= std::abs(pts.nx[i] * normal.x() + (pts.ny[i] * normal.y() + pts.nz[i] * normal.z())) >= align_threshold;
+            }
+            return inlier;
+        }
+
+        struct Hypothesis {
+            Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
+            Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+            int inliers = 0;
+            int iteration = -1;
+            int level = 0; // octree level the sample was drawn from
+        };
 
-        for(int i = 0; i < iterations; ++i) {
-            int idx1 = dist(rng), idx2 = dist(rng), idx3 = dist(rng);
-            Eigen::Vector3f centroid, normal;
-            estimate_plane(points[idx1], points[idx2], points[idx3], centroid, normal);
+        // Index of the first plane the point is an inlier of, -1 when there is none
+        int first_plane(const PointsView &pts, size_t k, const std::vector<Hypothesis> &planes, float threshold) {
+            for (size_t p = 0; p < planes.size(); ++p) {
+                if (is_inlier(pts, k, planes[p].centroid, planes[p].normal, threshold)) return static_cast<int>(p);
+            }
+            return -1;
+        }
+
+        // Plane through collinear samples, with a zero normal every point would be an inlier of it
+        bool degenerate(const Hypothesis &h) {
+            return h.normal.squaredNorm() == 0.0f;
+        }
+
+        // More inliers wins, ties go to the earliest hypothesis so the result does not depend on thread timing.
+        // Degenerate planes never win.
+        bool is_better(const Hypothesis &a, const Hypothesis &b) {
+            if (degenerate(a)) return false;
+            if (a.inliers != b.inliers) return a.inliers > b.inliers;
+            return a.inliers > 0 and a.iteration < b.iteration;
+        }
+
+        // Number of hypotheses needed to draw one all-inlier sample with the given confidence. With
+        // localized sampling over `depth` octree levels, a plane holding a ratio w of the points is hit
+        // with probability about w / (4 * depth) (Schnabel et al.), whichever is the more likely is used.
+        int required_iterations(double inlier_ratio, int depth = 0) {
+            double all_inliers = std::pow(inlier_ratio, 3);
+            if (depth > 0) all_inliers = std::max(all_inliers, inlier_ratio / (4.0 * depth));
+            if (all_inliers >= 1.0) return 0;
+            if (all_inliers <= 0.0) return iterations;
+            const double needed = std::ceil(std::log(1.0 - confidence) / std::log(1.0 - all_inliers));
+            return needed < iterations ? static_cast<int>(needed) : iterations;
+        }
+
+        // Hypotheses scored per stream between two updates of the adaptive budget and SPRT estimates
+        constexpr int round_chunk = 16;
+
+        // Points verified between two SPRT decisions, so the counting still runs on the SIMD kernel
+        constexpr size_t sprt_block = 256;
+        // Cost of generating a model, in point verifications (the K term of WaldSAC)
+        constexpr double sprt_model_cost = 200.0;
+
+        // Root A > 1 of A = k + 1 + log(A), that is -W_{-1}(-exp(-k - 1)), by Newton's method
+        double sprt_threshold(double k) {
+            double a = k + 1.0 + std::log(k + 1.0);
+            for (int i = 0; i < 50; ++i) {
+                const double step = (a - k - 1.0 - std::log(a)) / (1.0 - 1.0 / a);
+                a -= step;
+                if (std::abs(step) <= 1e-12 * a) break;
+            }
+            assert(std::abs(a - k - 1.0 - std::log(a)) <= 1e-9 * a);
+            return a;
+        }
+
+        // Wald's sequential probability ratio test deciding whether a hypothesis is worth scoring fully
+        struct Sprt {
+            double epsilon = 0.2; // inlier ratio of a good model, the best one found so far
+            double delta = 0.05; // probability that a point is consistent with a bad model
+            double log_a = 0.0; // log of the decision threshold A, infinite disables the test
+            double log_inlier = 0.0; // log likelihood ratio step for a consistent point
+            double log_outlier = 0.0; // log likelihood ratio step for an inconsistent point
 
-            // Count inliers
-            int inlier_count = 0;
-            for(const auto &point : points) {
-                if(point_to_plane_distance(point, centroid, normal) < dist_threshold) {
-                    ++inlier_count;
+            void update() {
+                if (delta <= 0.0 or delta >= epsilon or epsilon >= 1.0) {
+                    log_a = std::numeric_limits<double>::infinity();
+                    return;
                 }
+                log_inlier = std::log(delta / epsilon);
+                log_outlier = std::log((1.0 - delta) / (1.0 - epsilon));
+                // Wald's optimal A solves A = K * C + 1 + log(A), C being the expected log likelihood
+                // step of a point under a bad model, the Kullback-Leibler divergence of delta from epsilon
+                const double c = (1.0 - delta) * log_outlier + delta * log_inlier;
+                log_a = std::log(sprt_threshold(sprt_model_cost * c));
             }
+        };
 
-            // Update best plane if current one has more inliers
-            if(inlier_count > best_inlier_count) {
-                best_inlier_count = inlier_count;
-                best_point = centroid;
-                best_normal = normal;
+        // Points tested and found consistent by the hypotheses the SPRT rejected, used to re-estimate delta
+        struct SprtStats {
+            size_t tested = 0;
+            size_t consistent = 0;
+        };
+
+        // Counts inliers block by block, returns -1 as soon as the likelihood ratio rejects the plane.
+        // `tested` gets the points tested.
+        int sprt_count_inliers(const PointsView &pts, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal, float threshold, const Sprt &test, SprtStats &stats, size_t &tested) {
+            double log_lambda = 0.0;
+            tested = pts.size;
+            size_t inlier_count = 0;
+            for (size_t begin = 0; begin < pts.size; begin += sprt_block) {
+                const size_t count = std::min(sprt_block, pts.size - begin);
+                const size_t block_inliers = count_inliers(pts.slice(begin, count), centroid, normal, threshold, align_threshold);
+                inlier_count += block_inliers;
+                log_lambda += block_inliers * test.log_inlier + (count - block_inliers) * test.log_outlier;
+                if (log_lambda > test.log_a) {
+                    tested = begin + count;
+                    stats.tested += begin + count;
+                    stats.consistent += inlier_count;
+                    return -1;
+                }
             }
+            return static_cast<int>(inlier_count);
         }
-        // draw color
-        auto color = generate_color(0);
-        for(size_t i = 0; i < points.size(); i++) {
-            Eigen::Vector3f point = points[i];
-            if(point_to_plane_distance(point, best_point, best_normal) < dist_threshold) {
-                colors[i] = color;
+
+        // Working set as an N x 4 homogeneous block and its normals as N x 3, for batched scoring.
+        // Only the first `rows` rows are used, so the matrices are reallocated only when they grow.
+        struct BatchPoints {
+            Eigen::Matrix<float, Eigen::Dynamic, 4> points;
+            Eigen::Matrix<float, Eigen::Dynamic, 3> normals;
+            Eigen::Index rows = 0;
+            bool with_normals = false;
+
+            void fill(const PointsView &pts) {
+                rows = static_cast<Eigen::Index>(pts.size);
+                with_normals = pts.nx != nullptr;
+                if (points.rows() < rows) points.resize(rows, 4);
+                points.col(0).head(rows) = Eigen::Map<const Eigen::VectorXf>(pts.x, rows);
+                points.col(1).head(rows) = Eigen::Map<const Eigen::VectorXf>(pts.y, rows);
+                points.col(2).head(rows) = Eigen::Map<const Eigen::VectorXf>(pts.z, rows);
+                points.col(3).head(rows).setOnes();
+                if (with_normals) {
+                    if (normals.rows() < rows) normals.resize(rows, 3);
+                    normals.col(0).head(rows) = Eigen::Map<const Eigen::VectorXf>(pts.nx, rows);
+                    normals.col(1).head(rows) = Eigen::Map<const Eigen::VectorXf>(pts.ny, rows);
+                    normals.col(2).head(rows) = Eigen::Map<const Eigen::VectorXf>(pts.nz, rows);
+                }
+            }
+        };
+
+        // Rows of points multiplied at once, so the distance block of a whole batch stays in cache
+        constexpr Eigen::Index batch_rows = 256;
+
+        // Scores a group of hypotheses in one sweep over the points: the planes are packed as a
+        // 4 x H matrix of (n, -n.c) columns and each block of points gets all its distances from
+        // a single product, followed by a thresholded count per column
+        void score_batch(const BatchPoints &bp, std::vector<Hypothesis> &group, float threshold) {
+            const Eigen::Index h = static_cast<Eigen::Index>(group.size());
+            Eigen::Matrix<float, 4, Eigen::Dynamic> planes(4, h);
+            Eigen::Matrix<float, 3, Eigen::Dynamic> plane_normals(3, h);
+            for (Eigen::Index j = 0; j < h; ++j) {
+                planes.col(j) << group[j].normal, -group[j].normal.dot(group[j].centroid);
+                plane_normals.col(j) = group[j].normal;
+            }
+            const bool with_normals = bp.with_normals;
+            Eigen::MatrixXf dist(batch_rows, h), align(with_normals ? batch_rows : 0, h);
+            Eigen::Array<Eigen::Index, 1, Eigen::Dynamic> counts = Eigen::Array<Eigen::Index, 1, Eigen::Dynamic>::Zero(h);
+            for (Eigen::Index begin = 0; begin < bp.rows; begin += batch_rows) {
+                const Eigen::Index rows = std::min(batch_rows, bp.rows - begin);
+                dist.topRows(rows).noalias() = bp.points.middleRows(begin, rows) * planes;
+                if (with_normals) {
+                    align.topRows(rows).noalias() = bp.normals.middleRows(begin, rows) * plane_normals;
+                    counts += ((dist.topRows(rows).array().abs() < threshold) and (align.topRows(rows).array().abs() >= align_threshold)).colwise().count();
+                }
+                else {
+                    counts += (dist.topRows(rows).array().abs() < threshold).colwise().count();
+                }
+            }
+            for (Eigen::Index j = 0; j < h; ++j) {
+                group[j].inliers = static_cast<int>(counts(j));
             }
         }
-    }
 
-    float calculate_alignement(const Eigen::Vector3f &normal1, const Eigen::Vector3f &normal2) {
-        return std::abs(normal1.dot(normal2));
-    }
-        std::vector<size_t> ransac(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals, std::vector<size_t> remaining_idx, int colorIndex) {
-        int best_inlier_count = 0;
-        Eigen::Vector3f best_p;
-        Eigen::Vector3f best_n;
+        // Linear octree over the working set: the points are sorted by Morton code so that a cell at
+        // level l is the contiguous run of entries sharing the top 3 * l bits of their code
+        struct Octree {
+            int depth = 0;
+            std::vector<uint32_t> codes; // sorted Morton codes
+            std::vector<uint32_t> order; // working-set position of each sorted entry
+            std::vector<uint32_t> rank; // sorted entry of each working-set position
+            std::vector<uint64_t> keys; // (code, position) pairs, kept to reuse the allocation
+
+            static uint32_t spread_bits(uint32_t v) {
+                v = (v | (v << 16)) & 0x030000FF;
+                v = (v | (v << 8)) & 0x0300F00F;
+                v = (v | (v << 4)) & 0x030C30C3;
+                v = (v | (v << 2)) & 0x09249249;
+                return v;
+            }
+
+            void build(const PointsView &pts, int levels) {
+                depth = std::max(1, std::min(levels, 10));
+                const Eigen::Index n = static_cast<Eigen::Index>(pts.size);
+                const Eigen::Map<const Eigen::VectorXf> x(pts.x, n), y(pts.y, n), z(pts.z, n);
+                const Eigen::Vector3f lo(x.minCoeff(), y.minCoeff(), z.minCoeff());
+                const Eigen::Vector3f hi(x.maxCoeff(), y.maxCoeff(), z.maxCoeff());
+                const float side = std::max((hi - lo).maxCoeff(), std::numeric_limits<float>::min());
+                const float cells = static_cast<float>(1u << depth);
+                const uint32_t last = (1u << depth) - 1;
+                auto cell = [&](float v, float origin) {
+                    return std::min(last, static_cast<uint32_t>(std::max(0.0f, (v - origin) / side * cells)));
+                };
 
-        for(int i = 0; i < iterations; ++i) {
-            // Randomly select 3 different points
-            std::vector<Eigen::Vector3f> sample_points = select_3_random_points(points, remaining_idx);
-            
-            Eigen::Vector3f centroid, normal;
-            estimate_plane(sample_points[0], sample_points[1], sample_points[2], centroid, normal);
-            // Count inliers
-            int inlier_count = 0;
-            for(size_t i = 0; i < remaining_idx.size(); i++) {
-                Eigen::Vector3f remaining_point = points[remaining_idx[i]];
-                if(point_to_plane_distance(remaining_point, centroid, normal) < dist_threshold) {
-                    ++inlier_count;
+                keys.resize(pts.size);
+                for (size_t i = 0; i < pts.size; ++i) {
+                    const uint32_t code = spread_bits(cell(pts.x[i], lo.x())) << 2 | spread_bits(cell(pts.y[i], lo.y())) << 1 | spread_bits(cell(pts.z[i], lo.z()));
+                    keys[i] = static_cast<uint64_t>(code) << 32 | i;
                 }
+                std::sort(keys.begin(), keys.end());
+                codes.resize(pts.size);
+                order.resize(pts.size);
+                rank.resize(pts.size);
+                for (size_t r = 0; r < pts.size; ++r) {
+                    codes[r] = static_cast<uint32_t>(keys[r] >> 32);
+                    order[r] = static_cast<uint32_t>(keys[r]);
+                    rank[order[r]] = static_cast<uint32_t>(r);
+                }
+            }
+
+            // Sorted entries [first, second) of the cell holding entry r at the given level
+            std::pair<size_t, size_t> cell(size_t r, int level) const {
+                const int shift = 3 * (depth - level);
+                const uint64_t prefix = codes[r] >> shift;
+                const auto first = std::lower_bound(codes.begin(), codes.end(), static_cast<uint32_t>(prefix << shift));
+                const auto last = std::lower_bound(first, codes.end(), (prefix + 1) << shift,
+                                                   [](uint32_t code, uint64_t bound) { return code < bound; });
+                return {static_cast<size_t>(first - codes.begin()), static_cast<size_t>(last - codes.begin())};
+            }
+        };
+
+        // Sampling probabilities of the octree levels 1..depth, learnt from the planes already extracted
+        struct LevelWeights {
+            std::vector<double> weights;
+
+            void reset(int depth) { weights.assign(depth, 1.0 / depth); }
+            // P(l) = 0.9 * s_l / sum(s) + 0.1 / depth, s_l being the mean score of the samples drawn at level l
+            void update(const std::vector<double> &score_sum, const std::vector<double> &drawn) {
+                std::vector<double> mean(weights.size(), 0.0);
+                double total = 0.0;
+                for (size_t l = 0; l < weights.size(); ++l) {
+                    if (drawn[l] > 0.0) mean[l] = score_sum[l] / drawn[l];
+                    total += mean[l];
+                }
+                if (total <= 0.0) return;
+                for (size_t l = 0; l < weights.size(); ++l) {
+                    weights[l] = 0.9 * mean[l] / total + 0.1 / weights.size();
+                }
+            }
+            // Level index drawn with the probabilities of the weights, which sum to 1
+            int draw(tnp::Rng &rng) const {
+                double u = rng.uniform_double();
+                for (size_t l = 0; l + 1 < weights.size(); ++l) {
+                    if (u < weights[l]) return static_cast<int>(l);
+                    u -= weights[l];
+                }
+                return static_cast<int>(weights.size()) - 1;
+            }
+        };
+
+        // Efficient RANSAC sampling: the first point is drawn globally, the two others from the
+        // octree cell holding it at a level drawn from the level weights. Levels whose cell holds
+        // fewer than 3 points fall back to the next coarser one, level 0 being the whole set.
+        std::array<size_t, 3> select_3_octree_points(const Octree &octree, const LevelWeights &levels, tnp::Rng &rng, int &level) {
+            const size_t count = octree.order.size();
+            const size_t first = rng.below(count);
+            const size_t r0 = octree.rank[first];
+            level = levels.draw(rng) + 1;
+            std::pair<size_t, size_t> range{0, count};
+            for (; level > 0; --level) {
+                range = octree.cell(r0, level);
+                if (range.second - range.first >= 3) break;
             }
-            // Update best plane if current one has more inliers
-            if(inlier_count > best_inlier_count) {
-                best_inlier_count = inlier_count;
-                best_p = centroid;
-                best_n = normal;
+            if (level == 0) range = {0, count};
+            // two distinct entries of the cell, shifted past the first sample
+            const size_t m = range.second - range.first;
+            const size_t skip = r0 - range.first;
+            size_t a = rng.below(m - 1);
+            if (a >= skip) ++a;
+            size_t b = rng.below(m - 2);
+            if (b >= std::min(a, skip)) ++b;
+            if (b >= std::max(a, skip)) ++b;
+            return {first, octree.order[range.first + a], octree.order[range.first + b]};
+        }
+
+        // Schnabel et al. scoring on random subsets: the count is extrapolated from growing prefixes of
+        // the shuffled points, and the hypothesis is dropped (-1) once the upper bound of the ~95%
+        // hypergeometric confidence interval falls below the best score. `estimate` gets the
+        // extrapolated score and `evaluated` the points tested, the exact count is returned when
+        // every point was needed.
+        int subset_count_inliers(const PointsView &pts, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal, float threshold, int best_inliers, double &estimate, size_t &evaluated) {
+            const double n = static_cast<double>(pts.size);
+            evaluated = 0;
+            size_t inlier_count = 0;
+            size_t next = std::min(pts.size, std::max<size_t>(256, pts.size >> 6));
+            while (true) {
+                inlier_count += count_inliers(pts.slice(evaluated, next - evaluated), centroid, normal, threshold, align_threshold);
+                evaluated = next;
+                if (evaluated == pts.size) break;
+                const double ratio = static_cast<double>(inlier_count) / evaluated;
+                estimate = ratio * n;
+                const double deviation = n * std::sqrt(ratio * (1.0 - ratio) / evaluated * (n - evaluated) / (n - 1.0));
+                if (estimate + 2.0 * deviation < best_inliers) return -1;
+                next = std::min(pts.size, evaluated * 2);
             }
+            estimate = static_cast<double>(inlier_count);
+            return static_cast<int>(inlier_count);
         }
-        auto color = generate_color(colorIndex);
-        std::vector<size_t> new_remaining_idx;
-        for(size_t i = 0; i < remaining_idx.size(); i++) {
-            Eigen::Vector3f point = points[remaining_idx[i]];
-            if(point_to_plane_distance(point, best_p, best_n) < dist_threshold) {
-                colors[remaining_idx[i]] = color;
+
+        // Buffers reused across the plane extractions of one run, so extracting a plane does not
+        // allocate memory proportional to the cloud once the first plane is done
+        struct Scratch {
+            WorkingSet ws;
+            Octree octree;
+            BatchPoints batch;
+            LevelWeights level_weights;
+            Hypothesis extracted; // plane found by the last extract_plane
+        };
+
+        // Scores up to `iterations` hypotheses drawn from the points and returns the best one.
+        // Hypothesis i is drawn by stream i % streams, each stream owning its own generator, so a
+        // fixed seed and thread count always give the same plane. With a confidence set, the budget
+        // is recomputed from the best inlier ratio after every round of hypotheses. With the SPRT
+        // enabled, the points must be in random order: the first round is scored fully, then each
+        // round is tested sequentially with the epsilon/delta estimated from the rounds before it.
+        // With batches enabled, each stream scores its hypotheses batch_size at a time and the SPRT is not used.
+        // With an octree, samples are localized and scored on subsets instead of by the SPRT, and the
+        // level weights are updated from the scores of this plane.
+        Hypothesis find_best_plane(const PointsView &pts, float threshold, int plane, uint64_t base_seed, bool localized, Scratch &scratch, int &used) {
+            TNP_SCOPE("find_best_plane");
+            const Octree *octree = localized ? &scratch.octree : nullptr;
+            LevelWeights &level_weights = scratch.level_weights;
+            const unsigned streams = std::min(tnp::resolve_threads(threads), static_cast<unsigned>(std::max(1, iterations)));
+            std::vector<Hypothesis> best(streams);
+            std::vector<SprtStats> rejected(streams);
+            std::vector<size_t> tested(streams, 0);
+            Sprt test;
+            test.update();
+            // the streams of one plane are jumps of its generator, so they never overlap
+            std::vector<tnp::Rng> rngs;
+            rngs.reserve(streams);
+            tnp::Rng rng(tnp::mix_seed(base_seed, static_cast<uint64_t>(plane)));
+            for (unsigned stream = 0; stream < streams; ++stream) {
+                rngs.push_back(rng);
+                rng.jump();
+            }
+
+            const bool batched = batch_size > 1;
+            const bool subsets = octree and not batched;
+            const bool sprt_enabled = sprt and not batched and not subsets;
+            bool sequential = false; // until a fully scored round gives epsilon and delta
+            std::vector<std::vector<double>> level_sum(streams), level_drawn(streams);
+            if (octree) {
+                for (unsigned stream = 0; stream < streams; ++stream) {
+                    level_sum[stream].assign(octree->depth, 0.0);
+                    level_drawn[stream].assign(octree->depth, 0.0);
+                }
+            }
+            BatchPoints &bp = scratch.batch;
+            if (batched) bp.fill(pts);
+
+            const bool adaptive = confidence > 0.0f and confidence < 1.0f;
+            const int chunk = batched ? std::max(round_chunk, batch_size) : round_chunk;
+            const int round_size = adaptive or sprt_enabled or subsets ? static_cast<int>(streams) * chunk : iterations;
+            int budget = iterations;
+            int done = 0;
+            Hypothesis result;
+            while (done < budget) {
+                const int round_end = std::min(budget, done + round_size);
+                tnp::parallel_for(streams, streams, [&](size_t stream) {
+                    tnp::Rng &rng = rngs[stream];
+                    Hypothesis &local = best[stream];
+                    std::vector<Hypothesis> group;
+                    // scores below the best of the previous rounds are not worth completing
+                    const int bar = std::max(result.inliers, local.inliers);
+                    for (int i = done + static_cast<int>(stream); i < round_end; i += streams) {
+                        // Randomly select 3 different points
+                        Hypothesis candidate;
+                        const auto sample = octree ? select_3_octree_points(*octree, level_weights, rng, candidate.level)
+                                                   : select_3_random_points(pts.size, rng);
+                        estimate_plane(pts.point(sample[0]), pts.point(sample[1]), pts.point(sample[2]), candidate.centroid, candidate.normal);
+                        if (batched) {
+                            candidate.iteration = i;
+                            group.push_back(candidate);
+                            if (static_cast<int>(group.size()) == batch_size or i + static_cast<int>(streams) >= round_end) {
+                                score_batch(bp, group, threshold);
+                                tested[stream] += group.size() * pts.size;
+                                for (const auto &scored : group) {
+                                    if (is_better(scored, local)) local = scored;
+                                }
+                                group.clear();
+                            }
+                            continue;
+                        }
+                        if (degenerate(candidate)) continue;
+                        if (subsets) {
+                            double estimate = 0.0;
+                            size_t evaluated = 0;
+                            candidate.inliers = subset_count_inliers(pts, candidate.centroid, candidate.normal, threshold, std::max(bar, local.inliers), estimate, evaluated);
+                            tested[stream] += evaluated;
+                            if (candidate.level > 0) {
+                                level_sum[stream][candidate.level - 1] += estimate;
+                                level_drawn[stream][candidate.level - 1] += 1.0;
+                            }
+                        }
+                        else if (sequential) {
+                            size_t evaluated = 0;
+                            candidate.inliers = sprt_count_inliers(pts, candidate.centroid, candidate.normal, threshold, test, rejected[stream], evaluated);
+                            tested[stream] += evaluated;
+                        }
+                        else {
+                            candidate.inliers = static_cast<int>(count_inliers(pts, candidate.centroid, candidate.normal, threshold, align_threshold));
+                            tested[stream] += pts.size;
+                            if (sprt_enabled) {
+                                // nearly all fully scored hypotheses are bad, their consistency estimates delta
+                                rejected[stream].tested += pts.size;
+                                rejected[stream].consistent += static_cast<size_t>(candidate.inliers);
+                            }
+                        }
+                        candidate.iteration = i;
+                        if (is_better(candidate, local)) local = candidate;
+                    }
+                });
+                done = round_end;
+
+                // reduce the per-stream winners in stream order
+                for (const auto &candidate : best) {
+                    if (is_better(candidate, result)) result = candidate;
+                }
+                if (adaptive and result.inliers > 0) {
+                    budget = std::max(done, required_iterations(static_cast<double>(result.inliers) / pts.size, octree ? octree->depth : 0));
+                }
+                // the rounds are scored fully until one finds a model, the test never runs without
+                // a best model to compare against so it cannot reject every hypothesis of a plane
+                sequential = sprt_enabled and result.inliers > 0;
+                if (sequential) {
+                    // epsilon is the inlier ratio of the best model, delta the average consistency of
+                    // the fully scored and rejected ones
+                    SprtStats total;
+                    for (const auto &stats : rejected) {
+                        total.tested += stats.tested;
+                        total.consistent += stats.consistent;
+                    }
+                    if (total.tested > 0) test.delta = static_cast<double>(total.consistent) / total.tested;
+                    test.epsilon = static_cast<double>(result.inliers) / pts.size;
+                    test.update();
+                }
             }
-            else {
-                new_remaining_idx.push_back(remaining_idx[i]);
+            if (octree) {
+                std::vector<double> sum(octree->depth, 0.0), drawn(octree->depth, 0.0);
+                for (unsigned stream = 0; stream < streams; ++stream) {
+                    for (int l = 0; l < octree->depth; ++l) {
+                        sum[l] += level_sum[stream][l];
+                        drawn[l] += level_drawn[stream][l];
+                    }
+                }
+                level_weights.update(sum, drawn);
             }
+            used = done;
+            TNP_COUNT("hypotheses", done);
+            size_t tested_total = 0;
+            for (const size_t t : tested) tested_total += t;
+            TNP_COUNT("points tested", tested_total);
+            return result;
         }
-        return new_remaining_idx;
-    }
 
-    void ransac_multiple_planes(std::vector<Eigen::Vector3f>& points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals){
-        // use of index to select the remaining points
-        std::vector<size_t> remaining_idx;
-        int color_index = 0;
-        for (size_t i = 0; i < points.size(); ++i) {
-            remaining_idx.push_back(i);
+        using Clock = std::chrono::steady_clock;
+
+        // Orders hypotheses by score, ties by index and degenerate ones last, for the preemption steps
+        bool ranks_before(const Hypothesis &a, const Hypothesis &b) {
+            if (degenerate(a) != degenerate(b)) return degenerate(b);
+            if (a.inliers != b.inliers) return a.inliers > b.inliers;
+            return a.iteration < b.iteration;
         }
-        while (static_cast<float>(remaining_idx.size()) / static_cast<float>(points.size()) > pointsleft)
-        {
-            remaining_idx = ransac(points, colors, normals, remaining_idx, color_index);
-            color_index++;
+
+        // Nister's preemptive RANSAC: `iterations` hypotheses are generated up front and scored
+        // breadth-first on successive blocks of points, after the i-th block only the best
+        // iterations * 2^-i are kept. Scoring stops when one hypothesis is left, when the block
+        // budget is spent or when the deadline has passed. The points must be in random order.
+        Hypothesis preemptive_best_plane(const PointsView &pts, float threshold, int plane, uint64_t base_seed, Clock::time_point deadline, int &used) {
+            TNP_SCOPE("preemptive_best_plane");
+            const int count = std::max(1, iterations);
+            std::vector<Hypothesis> hypotheses(count);
+            tnp::Rng rng(tnp::mix_seed(base_seed, static_cast<uint64_t>(plane)));
+            for (int i = 0; i < count; ++i) {
+                const auto sample = select_3_random_points(pts.size, rng);
+                estimate_plane(pts.point(sample[0]), pts.point(sample[1]), pts.point(sample[2]), hypotheses[i].centroid, hypotheses[i].normal);
+                hypotheses[i].iteration = i;
+            }
+            used = count;
+
+            const size_t block = static_cast<size_t>(std::max(1, preemption_block));
+            size_t alive = hypotheses.size();
+            size_t tested = 0;
+            int blocks = 0;
+            for (size_t begin = 0; begin < pts.size and alive > 1; begin += block) {
+                if (block_budget > 0 and blocks >= block_budget) break;
+                if (blocks > 0 and Clock::now() >= deadline) break;
+                const PointsView slice = pts.slice(begin, std::min(block, pts.size - begin));
+                for (size_t h = 0; h < alive; ++h) {
+                    hypotheses[h].inliers += static_cast<int>(count_inliers(slice, hypotheses[h].centroid, hypotheses[h].normal, threshold, align_threshold));
+                }
+                tested += alive * slice.size;
+                ++blocks;
+                // preemption function f(i) = floor(M * 2^-floor(i / B))
+                const size_t keep = blocks < 63 ? std::max<size_t>(1, hypotheses.size() >> blocks) : 1;
+                if (keep < alive) {
+                    std::partial_sort(hypotheses.begin(), hypotheses.begin() + keep, hypotheses.begin() + alive, ranks_before);
+                    alive = keep;
+                }
+            }
+            TNP_COUNT("hypotheses", count);
+            TNP_COUNT("points tested", tested);
+            return *std::min_element(hypotheses.begin(), hypotheses.begin() + alive, ranks_before);
         }
-    }
-    
 
-    std::vector<size_t> ransac_with_normals(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals, std::vector<size_t> remaining_idx, int colorIndex) {
-        int best_inlier_count = 0;
-        Eigen::Vector3f best_p;
-        Eigen::Vector3f best_n;
+        // Finds the best plane among idx[0, count), colors its inliers and partitions the range in
+        // place: the other points are compacted to the front and the inliers moved to the tail.
+        // Returns the number of points left.
+        template<typename Cloud>
+        size_t extract_plane(Cloud &cloud, std::vector<size_t> &idx, size_t count, int colorIndex, bool with_normals, float threshold,
+                             Scratch &scratch, bool preemptive = false, Clock::time_point deadline = Clock::time_point::max()) {
+            if (count < 3) return count;
+            TNP_SCOPE("plane");
+            const uint64_t base_seed = seed != 0 ? seed : tnp::random_seed();
+            const bool localized = octree_sampling and not preemptive and count <= std::numeric_limits<uint32_t>::max();
+            // the SPRT, the subset and the preemptive scoring verify the points in order, so they are shuffled once per plane
+            if (sprt or preemptive or localized) {
+                tnp::Rng rng(tnp::mix_seed(tnp::mix_seed(base_seed, static_cast<uint64_t>(colorIndex)), ~uint64_t(0)));
+                tnp::shuffle(idx.begin(), idx.begin() + count, rng);
+            }
 
-        for(int i = 0; i < iterations; ++i) {
-            // Randomly select 3 different points
-            std::vector<Eigen::Vector3f> sample_points = select_3_random_points(points, remaining_idx);
-            
-            Eigen::Vector3f centroid, normal;
-            estimate_plane(sample_points[0], sample_points[1], sample_points[2], centroid, normal);
-            // Count inliers
-            int inlier_count = 0;
-            for(size_t i = 0; i < remaining_idx.size(); i++) {
-                Eigen::Vector3f remaining_point = points[remaining_idx[i]];
-                Eigen::Vector3f remaining_normal = normals[remaining_idx[i]];
-                // filtering by distance threshold and normal
-                if(point_to_plane_distance(remaining_point, centroid, normal) < dist_threshold and calculate_alignement(remaining_normal, normal) >= align_threshold) {
-                    ++inlier_count;
+            const PointsView pts = gather(cloud, IndexSpan{idx.data(), count}, with_normals and cloud.has_normals(), scratch.ws);
+            if (localized) {
+                scratch.octree.build(pts, octree_depth);
+                if (static_cast<int>(scratch.level_weights.weights.size()) != scratch.octree.depth) scratch.level_weights.reset(scratch.octree.depth);
+            }
+            int used = 0;
+            const Hypothesis best = preemptive ? preemptive_best_plane(pts, threshold, colorIndex, base_seed, deadline, used)
+                                               : find_best_plane(pts, threshold, colorIndex, base_seed, localized, scratch, used);
+            iterations_used.push_back(used);
+            scratch.extracted = best;
+            TNP_COUNT("iterations", used);
+            // no hypothesis was accepted, a default plane would take every point
+            if (best.inliers <= 0 or degenerate(best)) return count;
+
+            // swapping only touches entries up to k, so idx[k] still matches working-set position k
+            auto color = generate_color(colorIndex);
+            size_t left = 0;
+            for (size_t k = 0; k < count; k++) {
+                if (is_inlier(pts, k, best.centroid, best.normal, threshold)) {
+                    cloud.set_color(idx[k], color);
+                    cloud.set_label(idx[k], colorIndex);
+                }
+                else {
+                    std::swap(idx[left++], idx[k]);
                 }
             }
+            TNP_COUNT("inliers", count - left);
+            return left;
+        }
+
+        // One plane extraction outside of a multi-plane run, returning the remaining indices
+        template<typename Cloud>
+        std::vector<size_t> extract_single_plane(Cloud &cloud, const std::vector<size_t> &remaining_idx, int colorIndex, bool with_normals) {
+            Scratch scratch;
+            std::vector<size_t> idx = remaining_idx;
+            TNP_ALLOCATION(idx.size() * sizeof(size_t));
+            idx.resize(extract_plane(cloud, idx, idx.size(), colorIndex, with_normals, dist_threshold, scratch));
+            return idx;
+        }
+
+        // Extracts planes until at most `pointsleft` of the points are left and returns them in order
+        template<typename Cloud>
+        std::vector<Hypothesis> extract_planes_full(Cloud &cloud, bool with_normals, bool preemptive, float threshold) {
+            iterations_used.clear();
+            const Clock::time_point deadline = preemptive and time_budget > 0.0
+                ? Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(time_budget))
+                : Clock::time_point::max();
+            // one index buffer for the whole run, the remaining points are always idx[0, remaining)
+            std::vector<size_t> idx(cloud.size());
+            TNP_ALLOCATION(idx.size() * sizeof(size_t));
+            for (size_t i = 0; i < cloud.size(); ++i) {
+                idx[i] = i;
+            }
+            size_t remaining = idx.size();
+            Scratch scratch;
+            std::vector<Hypothesis> planes;
+            int color_index = 0;
+            while (static_cast<float>(remaining) / static_cast<float>(cloud.size()) > pointsleft)
+            {
+                if (Clock::now() >= deadline) break;
+                const size_t left = extract_plane(cloud, idx, remaining, color_index, with_normals, threshold, scratch, preemptive, deadline);
+                // no plane could be extracted anymore
+                if (left == remaining) break;
+                planes.push_back(scratch.extracted);
+                remaining = left;
+                color_index++;
+            }
+            return planes;
+        }
+
+        const tnp::PointCloud &as_point_cloud(tnp::PointCloud &cloud, tnp::PointCloud &) {
+            return cloud;
+        }
+
+        const tnp::PointCloud &as_point_cloud(VectorCloud &cloud, tnp::PointCloud &storage) {
+            storage = tnp::PointCloud(cloud.points, cloud.normals);
+            return storage;
+        }
+
+        PointsView cloud_view(const tnp::PointCloud &cloud, bool with_normals) {
+            PointsView pts{cloud.x().data(), cloud.y().data(), cloud.z().data()};
+            if (with_normals and cloud.has_normals()) {
+                pts.nx = cloud.nx().data();
+                pts.ny = cloud.ny().data();
+                pts.nz = cloud.nz().data();
+            }
+            pts.size = cloud.size();
+            return pts;
+        }
 
-            // Update best plane if current one has more inliers
-            if(inlier_count > best_inlier_count) {
-                best_inlier_count = inlier_count;
-                best_p = centroid;
-                best_n = normal;
+        // Least-squares refit of every plane, in one pass over the points. Like the final labeling, a
+        // point counts for the first plane it lies within `band` of with an aligned normal. The sums
+        // are split in a fixed number of slices so the result does not depend on the thread count,
+        // a plane fewer than 3 points count for is kept as is.
+        void refit_planes(const PointsView &pts, std::vector<Hypothesis> &planes, float band) {
+            constexpr size_t slices = 64;
+            struct Moments {
+                Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+                Eigen::Matrix3d outer = Eigen::Matrix3d::Zero();
+                size_t count = 0;
+            };
+            std::vector<Moments> partial(slices * planes.size());
+            tnp::parallel_for(slices, tnp::resolve_threads(threads), [&](size_t s) {
+                for (size_t k = pts.size * s / slices; k < pts.size * (s + 1) / slices; ++k) {
+                    for (size_t p = 0; p < planes.size(); ++p) {
+                        const Eigen::Vector3f &c = planes[p].centroid, &n = planes[p].normal;
+                        const float dist = std::abs(n.x() * (pts.x[k] - c.x()) + n.y() * (pts.y[k] - c.y()) + n.z() * (pts.z[k] - c.z()));
+                        if (not (dist < band)) continue;
+                        if (pts.nx and std::abs(pts.nx[k] * n.x() + pts.ny[k] * n.y() + pts.nz[k] * n.z()) < align_threshold) continue;
+                        Moments &m = partial[s * planes.size() + p];
+                        const Eigen::Vector3d point(pts.x[k], pts.y[k], pts.z[k]);
+                        m.sum += point;
+                        m.outer += point * point.transpose();
+                        ++m.count;
+                        break;
+                    }
+                }
+            });
+            for (size_t p = 0; p < planes.size(); ++p) {
+                Moments total;
+                for (size_t s = 0; s < slices; ++s) {
+                    const Moments &m = partial[s * planes.size() + p];
+                    total.sum += m.sum;
+                    total.outer += m.outer;
+                    total.count += m.count;
+                }
+                if (total.count < 3) continue;
+                const Eigen::Vector3d mean = total.sum / static_cast<double>(total.count);
+                const Eigen::Matrix3d covariance = total.outer / static_cast<double>(total.count) - mean * mean.transpose();
+                Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+                solver.computeDirect(covariance);
+                Eigen::Vector3f normal = solver.eigenvectors().col(0).cast<float>().normalized();
+                if (normal.dot(planes[p].normal) < 0.0f) normal = -normal;
+                planes[p].centroid = mean.cast<float>();
+                planes[p].normal = normal;
+                planes[p].inliers = static_cast<int>(std::min<size_t>(total.count, std::numeric_limits<int>::max()));
             }
         }
-        auto color = generate_color(colorIndex);
-        std::vector<size_t> new_remaining_idx;
-        for(size_t i = 0; i < remaining_idx.size(); i++) {
-            Eigen::Vector3f remaining_point = points[remaining_idx[i]];
-            Eigen::Vector3f remaining_normal = normals[remaining_idx[i]];
-            if(point_to_plane_distance(remaining_point, best_p, best_n) < dist_threshold and calculate_alignement(remaining_normal, best_n) >= align_threshold) {
-                colors[remaining_idx[i]] = color;
+
+        // With a voxel size the planes are searched and scored on the voxel grid centroids, then
+        // every full resolution point gets the color and label of the first plane it is an inlier of.
+        // With a pyramid, the grids double their cell size at every level, the planes are found on
+        // the coarsest one and refit level after level from the points near them, ending at full resolution.
+        template<typename Cloud>
+        void extract_planes(Cloud &cloud, bool with_normals, bool preemptive = false) {
+            downsampled_size = 0;
+            if (voxel_size <= 0.0f or cloud.size() == 0) {
+                extract_planes_full(cloud, with_normals, preemptive, dist_threshold);
+                return;
+            }
+            tnp::PointCloud storage;
+            const tnp::PointCloud &full = as_point_cloud(cloud, storage);
+            const int levels = std::max(1, pyramid_levels);
+            std::vector<tnp::PointCloud> pyramid;
+            {
+                TNP_SCOPE("voxel pyramid");
+                pyramid.push_back(tnp::voxel_downsample(full, voxel_size, threads));
+                for (int l = 1; l < levels; ++l) {
+                    pyramid.push_back(tnp::voxel_downsample(pyramid.back(), std::ldexp(voxel_size, l), threads));
+                }
             }
-            else {
-                new_remaining_idx.push_back(remaining_idx[i]);
+            tnp::PointCloud &coarsest = pyramid.back();
+            downsampled_size = coarsest.size();
+            prepare(coarsest);
+            // the centroids of a coarse cell stray from the plane by up to half a cell
+            const float coarse_threshold = levels > 1 ? std::max(dist_threshold, 0.5f * std::ldexp(voxel_size, levels - 1)) : dist_threshold;
+            std::vector<Hypothesis> planes = extract_planes_full(coarsest, with_normals, preemptive, coarse_threshold);
+
+            const PointsView pts = cloud_view(full, with_normals);
+            if (levels > 1) {
+                TNP_SCOPE("refit");
+                // the band covers the cell size of the level the planes come from
+                for (int l = levels - 2; l >= 0; --l) {
+                    refit_planes(cloud_view(pyramid[l], with_normals), planes, std::max(dist_threshold, std::ldexp(voxel_size, l + 1)));
+                }
+                refit_planes(pts, planes, dist_threshold);
+            }
+
+            std::vector<Eigen::Vector3f> colors;
+            for (size_t p = 0; p < planes.size(); ++p) colors.push_back(generate_color(static_cast<int>(p)));
+            TNP_SCOPE("label");
+            const unsigned workers = tnp::resolve_threads(threads);
+            tnp::parallel_for(workers, workers, [&](size_t w) {
+                for (size_t k = pts.size * w / workers; k < pts.size * (w + 1) / workers; ++k) {
+                    const int plane = first_plane(pts, k, planes, dist_threshold);
+                    if (plane < 0) continue;
+                    cloud.set_color(k, colors[plane]);
+                    cloud.set_label(k, plane);
+                }
+            });
+        }
+
+        template<typename Cloud>
+        void single_plane(Cloud &cloud) {
+            iterations_used.clear();
+            std::vector<size_t> all_idx(cloud.size());
+            for (size_t i = 0; i < cloud.size(); ++i) {
+                all_idx[i] = i;
             }
+            extract_single_plane(cloud, all_idx, 0, false);
         }
-        return new_remaining_idx;
+    }
+
+    void simple_ransac(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors) {
+        TNP_SCOPE("simple_ransac");
+        const std::vector<Eigen::Vector3f> no_normals;
+        VectorCloud cloud{points, no_normals, colors};
+        single_plane(cloud);
+    }
+
+    void simple_ransac(tnp::PointCloud &cloud) {
+        TNP_SCOPE("simple_ransac");
+        prepare(cloud);
+        single_plane(cloud);
+    }
+
+    std::vector<size_t> ransac(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals, const std::vector<size_t> &remaining_idx, int colorIndex) {
+        TNP_SCOPE("ransac");
+        VectorCloud cloud{points, normals, colors};
+        return extract_single_plane(cloud, remaining_idx, colorIndex, false);
+    }
+
+    std::vector<size_t> ransac(tnp::PointCloud &cloud, const std::vector<size_t> &remaining_idx, int colorIndex) {
+        TNP_SCOPE("ransac");
+        prepare(cloud);
+        return extract_single_plane(cloud, remaining_idx, colorIndex, false);
+    }
+
+    void ransac_multiple_planes(std::vector<Eigen::Vector3f>& points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals){
+        TNP_SCOPE("ransac_multiple_planes");
+        VectorCloud cloud{points, normals, colors};
+        extract_planes(cloud, false);
+    }
+
+    void ransac_multiple_planes(tnp::PointCloud &cloud){
+        TNP_SCOPE("ransac_multiple_planes");
+        prepare(cloud);
+        extract_planes(cloud, false);
+    }
+
+    std::vector<size_t> ransac_with_normals(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals, const std::vector<size_t> &remaining_idx, int colorIndex) {
+        TNP_SCOPE("ransac_with_normals");
+        VectorCloud cloud{points, normals, colors};
+        return extract_single_plane(cloud, remaining_idx, colorIndex, true);
+    }
+
+    std::vector<size_t> ransac_with_normals(tnp::PointCloud &cloud, const std::vector<size_t> &remaining_idx, int colorIndex) {
+        TNP_SCOPE("ransac_with_normals");
+        prepare(cloud);
+        return extract_single_plane(cloud, remaining_idx, colorIndex, true);
     }
 
     void ransac_n_mult_planes(std::vector<Eigen::Vector3f>& points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals){
-        // use of index to select the remaining points
-        std::vector<size_t> remaining_idx;
-        int color_index = 0;
-        for (size_t i = 0; i < points.size(); ++i) {
-            remaining_idx.push_back(i);
+        TNP_SCOPE("ransac_n_mult_planes");
+        VectorCloud cloud{points, normals, colors};
+        extract_planes(cloud, true);
+    }
+
+    void ransac_n_mult_planes(tnp::PointCloud &cloud){
+        TNP_SCOPE("ransac_n_mult_planes");
+        prepare(cloud);
+        extract_planes(cloud, true);
+    }
+
+    void preemptive_ransac(std::vector<Eigen::Vector3f>& points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals){
+        TNP_SCOPE("preemptive_ransac");
+        VectorCloud cloud{points, normals, colors};
+        extract_planes(cloud, true, true);
+    }
+
+    void preemptive_ransac(tnp::PointCloud &cloud){
+        TNP_SCOPE("preemptive_ransac");
+        prepare(cloud);
+        extract_planes(cloud, true, true);
+    }
+    namespace {
+        // Scoring view over a streamed chunk, with normals only when they are tested
+        PointsView chunk_view(const tnp::CloudChunk &chunk, bool with_normals) {
+            PointsView view{chunk.x, chunk.y, chunk.z};
+            if (with_normals and chunk.nx) {
+                view.nx = chunk.nx;
+                view.ny = chunk.ny;
+                view.nz = chunk.nz;
+            }
+            view.size = chunk.size;
+            return view;
+        }
+
+        // Copies the points of the chunk no plane has taken yet, in order. The chunk is split in blocks
+        // that are tested in parallel, each block then copies its free points at the offset the
+        // prefix sum of the block counts gives it. `is_free` is scratch for the per point results.
+        PointsView gather_free(const PointsView &pts, const std::vector<Hypothesis> &planes, WorkingSet &ws, std::vector<uint8_t> &is_free) {
+            if (planes.empty()) return pts;
+            constexpr size_t blocks = 64;
+            for (auto *buffer : {&ws.x, &ws.y, &ws.z, &ws.nx, &ws.ny, &ws.nz}) resize_buffer(*buffer, pts.size);
+            is_free.resize(pts.size);
+            std::vector<size_t> offsets(blocks + 1, 0);
+            const unsigned workers = tnp::resolve_threads(threads);
+            tnp::parallel_for(blocks, workers, [&](size_t b) {
+                size_t count = 0;
+                for (size_t k = pts.size * b / blocks; k < pts.size * (b + 1) / blocks; ++k) {
+                    is_free[k] = first_plane(pts, k, planes, dist_threshold) < 0;
+                    count += is_free[k];
+                }
+                offsets[b + 1] = count;
+            });
+            for (size_t b = 0; b < blocks; ++b) offsets[b + 1] += offsets[b];
+            tnp::parallel_for(blocks, workers, [&](size_t b) {
+                size_t n = offsets[b];
+                for (size_t k = pts.size * b / blocks; k < pts.size * (b + 1) / blocks; ++k) {
+                    if (not is_free[k]) continue;
+                    ws.x[n] = pts.x[k]; ws.y[n] = pts.y[k]; ws.z[n] = pts.z[k];
+                    if (pts.nx) {
+                        ws.nx[n] = pts.nx[k]; ws.ny[n] = pts.ny[k]; ws.nz[n] = pts.nz[k];
+                    }
+                    ++n;
+                }
+            });
+            PointsView view{ws.x.data(), ws.y.data(), ws.z.data()};
+            if (pts.nx) {
+                view.nx = ws.nx.data();
+                view.ny = ws.ny.data();
+                view.nz = ws.nz.data();
+            }
+            view.size = offsets[blocks];
+            return view;
         }
-        while (static_cast<float>(remaining_idx.size()) / static_cast<float>(points.size()) > pointsleft)
+
+        // The `count` best of `iterations` hypotheses drawn from and scored on the in-memory sample
+        std::vector<Hypothesis> sample_candidates(const PointsView &sample, int plane, uint64_t base_seed, size_t count) {
+            std::vector<Hypothesis> hypotheses(std::max(1, iterations));
+            tnp::Rng rng(tnp::mix_seed(base_seed, static_cast<uint64_t>(plane)));
+            for (size_t i = 0; i < hypotheses.size(); ++i) {
+                const auto sample_idx = select_3_random_points(sample.size, rng);
+                estimate_plane(sample.point(sample_idx[0]), sample.point(sample_idx[1]), sample.point(sample_idx[2]), hypotheses[i].centroid, hypotheses[i].normal);
+                hypotheses[i].iteration = static_cast<int>(i);
+            }
+            tnp::parallel_for(hypotheses.size(), tnp::resolve_threads(threads), [&](size_t i) {
+                hypotheses[i].inliers = static_cast<int>(count_inliers(sample, hypotheses[i].centroid, hypotheses[i].normal, dist_threshold, align_threshold));
+            });
+            const size_t keep = std::min(count, hypotheses.size());
+            std::partial_sort(hypotheses.begin(), hypotheses.begin() + keep, hypotheses.end(), ranks_before);
+            hypotheses.resize(keep);
+            return hypotheses;
+        }
+    }
+
+    bool streaming_ransac(const std::string &input, const std::string &output) {
+        TNP_SCOPE("streaming_ransac");
+        iterations_used.clear();
+        tnp::CloudReader reader;
+        if (not reader.open(input)) return false;
+        const bool with_normals = reader.has_normals();
+        const uint64_t base_seed = seed != 0 ? seed : tnp::random_seed();
+        const unsigned workers = tnp::resolve_threads(threads);
+        const size_t chunk_size = static_cast<size_t>(std::max(1, stream_chunk));
+        const size_t capacity = static_cast<size_t>(std::max(3, stream_sample));
+
+        // first pass: count the points and keep a uniform reservoir sample to draw hypotheses from
+        WorkingSet sample;
+        for (auto *buffer : {&sample.x, &sample.y, &sample.z}) buffer->resize(capacity);
+        if (with_normals) {
+            for (auto *buffer : {&sample.nx, &sample.ny, &sample.nz}) buffer->resize(capacity);
+        }
+        size_t total = 0;
+        tnp::CloudChunk chunk;
         {
-            remaining_idx = ransac_with_normals(points, colors, normals, remaining_idx, color_index);
-            color_index++;
+            TNP_SCOPE("sample pass");
+            tnp::Rng rng(tnp::mix_seed(base_seed, ~uint64_t(0)));
+            while (reader.next(chunk_size, chunk)) {
+                for (size_t k = 0; k < chunk.size; ++k, ++total) {
+                    size_t slot = total;
+                    if (total >= capacity) {
+                        slot = rng.below(total + 1);
+                        if (slot >= capacity) continue;
+                    }
+                    sample.x[slot] = chunk.x[k]; sample.y[slot] = chunk.y[k]; sample.z[slot] = chunk.z[k];
+                    if (with_normals) {
+                        sample.nx[slot] = chunk.nx[k]; sample.ny[slot] = chunk.ny[k]; sample.nz[slot] = chunk.nz[k];
+                    }
+                }
+            }
+        }
+        if (reader.failed()) return false;
+        if (total == 0) {
+            std::cout << "Error: no points read from '" << input << "'" << std::endl;
+            return false;
+        }
+        size_t sample_size = std::min(total, capacity);
+
+        // one pass per plane scores the candidates on every point no earlier plane has taken
+        std::vector<Hypothesis> planes;
+        WorkingSet free_points;
+        std::vector<uint8_t> free_mask;
+        size_t remaining = total;
+        while (static_cast<float>(remaining) / static_cast<float>(total) > pointsleft and sample_size >= 3) {
+            TNP_SCOPE("plane pass");
+            PointsView sample_pts{sample.x.data(), sample.y.data(), sample.z.data()};
+            if (with_normals) {
+                sample_pts.nx = sample.nx.data();
+                sample_pts.ny = sample.ny.data();
+                sample_pts.nz = sample.nz.data();
+            }
+            sample_pts.size = sample_size;
+            const auto candidates = sample_candidates(sample_pts, static_cast<int>(planes.size()), base_seed, static_cast<size_t>(std::max(1, stream_candidates)));
+            iterations_used.push_back(std::max(1, iterations));
+
+            std::vector<size_t> counts(candidates.size(), 0);
+            size_t free_count = 0;
+            reader.rewind();
+            while (reader.next(chunk_size, chunk)) {
+                const PointsView left = gather_free(chunk_view(chunk, with_normals), planes, free_points, free_mask);
+                free_count += left.size;
+                tnp::parallel_for(candidates.size(), workers, [&](size_t h) {
+                    counts[h] += count_inliers(left, candidates[h].centroid, candidates[h].normal, dist_threshold, align_threshold);
+                });
+            }
+            if (reader.failed()) return false;
+            size_t best = counts.size();
+            for (size_t h = 0; h < counts.size(); ++h) {
+                if (not degenerate(candidates[h]) and (best == counts.size() or counts[h] > counts[best])) best = h;
+            }
+            TNP_COUNT("hypotheses", candidates.size());
+            TNP_COUNT("points tested", free_count * candidates.size());
+            // no plane could be extracted anymore
+            if (best == counts.size() or counts[best] < 3) break;
+            TNP_COUNT("inliers", counts[best]);
+            planes.push_back(candidates[best]);
+            planes.back().inliers = static_cast<int>(std::min<size_t>(counts[best], std::numeric_limits<int>::max()));
+            remaining = free_count - counts[best];
+
+            // the inliers of the new plane leave the sample
+            size_t kept = 0;
+            for (size_t k = 0; k < sample_size; ++k) {
+                if (is_inlier(sample_pts, k, planes.back().centroid, planes.back().normal, dist_threshold)) continue;
+                sample.x[kept] = sample.x[k]; sample.y[kept] = sample.y[k]; sample.z[kept] = sample.z[k];
+                if (with_normals) {
+                    sample.nx[kept] = sample.nx[k]; sample.ny[kept] = sample.ny[k]; sample.nz[kept] = sample.nz[k];
+                }
+                ++kept;
+            }
+            sample_size = kept;
+        }
+
+        // last pass: every point gets the label and color of its plane and is written out
+        TNP_SCOPE("write pass");
+        tnp::CloudWriter writer;
+        if (not writer.open(output, total, reader.has_normals())) return false;
+        std::vector<Eigen::Vector3f> plane_colors;
+        for (size_t p = 0; p < planes.size(); ++p) plane_colors.push_back(generate_color(static_cast<int>(p)));
+        tnp::PointCloud::Buffer r, g, b;
+        std::vector<int32_t> labels;
+        reader.rewind();
+        while (reader.next(chunk_size, chunk)) {
+            const PointsView pts = chunk_view(chunk, with_normals);
+            r.resize(chunk.size); g.resize(chunk.size); b.resize(chunk.size);
+            labels.resize(chunk.size);
+            tnp::parallel_for(workers, workers, [&](size_t w) {
+                const size_t begin = chunk.size * w / workers, end = chunk.size * (w + 1) / workers;
+                for (size_t k = begin; k < end; ++k) {
+                    labels[k] = first_plane(pts, k, planes, dist_threshold);
+                    const Eigen::Vector3f color = labels[k] >= 0 ? plane_colors[labels[k]] : Eigen::Vector3f(0.5f, 0.5f, 0.5f);
+                    r[k] = color.x(); g[k] = color.y(); b[k] = color.z();
+                }
+            });
+            if (not writer.write(chunk, r.data(), g.data(), b.data(), labels.data())) break;
         }
+        const bool written = writer.close();
+        return written and not reader.failed();
     }
 }
\ No newline at end of file
@@ -3,8 +3,9 @@
 #include <Eigen/Geometry>
 #include <iostream>
 #include <vector>
-#include <random>
+#include <array>
 #include <obj.h>
+#include <random.hh>
 
 namespace RANSAC{
     // RANSAC parameters
@@ -12,17 +13,61 @@ namespace RANSAC{
     extern float dist_threshold; // Distance threshold for inliers
     extern float align_threshold;
     extern float pointsleft;
+    extern int threads; // Worker threads for hypothesis scoring, 0 = all hardware threads
+    extern uint64_t seed; // Random seed, 0 = a different one for every run
+    extern float confidence; // Stop once a plane is found with this probability, 0 = always run all iterations
+    extern std::vector<int> iterations_used; // Iterations actually run for each extracted plane
+    extern bool sprt; // Abandon hopeless hypotheses early with a sequential probability ratio test
+    extern int batch_size; // Hypotheses scored together as one matrix product per block of points, 0 = one by one
+    extern bool octree_sampling; // Draw the 2nd and 3rd samples from the octree cell of the 1st one and score on subsets
+    extern int octree_depth; // Finest octree level used for localized sampling, at most 10
+    extern int preemption_block; // Points scored per hypothesis between two preemption steps of preemptive_ransac
+    extern int block_budget; // Maximum point blocks scored per plane by preemptive_ransac, 0 = no limit
+    extern double time_budget; // Deadline in seconds for the whole preemptive_ransac run, 0 = no deadline
+    extern int stream_chunk; // Points read at once by streaming_ransac
+    extern int stream_sample; // Points kept in memory by streaming_ransac to draw hypotheses from
+    extern int stream_candidates; // Best hypotheses on the sample scored over the whole file for each plane
+    extern float voxel_size; // Multi-plane search on the centroids of a voxel grid with this cell size, 0 = full resolution
+    extern int pyramid_levels; // Voxel grids of voxel_size * 2^l for l < pyramid_levels, planes found on the coarsest are refit down to full resolution
+    extern size_t downsampled_size; // Points searched by the last voxel grid run, 0 when it ran at full resolution
+
+    // Non-owning view over a contiguous range of point indices
+    struct IndexSpan {
+        const size_t *data;
+        size_t size;
+    };
 
     void estimate_plane(const Eigen::Vector3f &p1, const Eigen::Vector3f &p2, const Eigen::Vector3f &p3, 
                         Eigen::Vector3f &centroid, Eigen::Vector3f &normal);
     float point_to_plane_distance(const Eigen::Vector3f &point, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal);
-    std::vector<Eigen::Vector3f> select_3_random_points(std::vector<Eigen::Vector3f> points, std::vector<size_t> remaining_idx);
+    float calculate_alignement(const Eigen::Vector3f &normal1, const Eigen::Vector3f &normal2);
+    // Draws three distinct positions in [0, count), count must be at least 3
+    std::array<size_t, 3> select_3_random_points(size_t count, tnp::Rng &rng);
+    // Draws three distinct indices from the view, remaining.size must be at least 3
+    std::array<size_t, 3> select_3_random_points(IndexSpan remaining, tnp::Rng &rng);
 
     void simple_ransac(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors);
+    void simple_ransac(tnp::PointCloud &cloud);
     
-    std::vector<size_t> ransac(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals, std::vector<size_t> remaining_idx, int colorIndex);
+    std::vector<size_t> ransac(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals, const std::vector<size_t> &remaining_idx, int colorIndex);
+    std::vector<size_t> ransac(tnp::PointCloud &cloud, const std::vector<size_t> &remaining_idx, int colorIndex);
     void ransac_multiple_planes(std::vector<Eigen::Vector3f>& points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals);
+    void ransac_multiple_planes(tnp::PointCloud &cloud);
     
-    std::vector<size_t> ransac_with_normals(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals, std::vector<size_t> remaining_idx, int colorIndex);
+    std::vector<size_t> ransac_with_normals(const std::vector<Eigen::Vector3f> &points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals, const std::vector<size_t> &remaining_idx, int colorIndex);
+    std::vector<size_t> ransac_with_normals(tnp::PointCloud &cloud, const std::vector<size_t> &remaining_idx, int colorIndex);
     void ransac_n_mult_planes(std::vector<Eigen::Vector3f>& points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals);
+    void ransac_n_mult_planes(tnp::PointCloud &cloud);
+
+    // Multiple planes with Nister's preemptive scoring, normals are tested when present.
+    // Every plane costs at most `iterations` hypotheses scored on `block_budget` blocks of points,
+    // and extraction stops once `time_budget` seconds have passed.
+    void preemptive_ransac(std::vector<Eigen::Vector3f>& points, std::vector<Eigen::Vector3f> &colors, std::vector<Eigen::Vector3f>& normals);
+    void preemptive_ransac(tnp::PointCloud &cloud);
+
+    // Multiple planes of a .bpc or .obj cloud too large for memory, normals are tested when present.
+    // Hypotheses are drawn from a `stream_sample` point reservoir and the `stream_candidates` best
+    // are scored over the file in `stream_chunk` point chunks, one pass per plane. A last pass
+    // writes the points with their plane color and label to a .ply or .bpc output.
+    bool streaming_ransac(const std::string &input, const std::string &output);
 }
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+// Public interface of the ransac_core library: point clouds and their file formats, normal
+// estimation, voxel downsampling, synthetic scenes, seeded random streams and plane detection.
+// Parameters are the globals of the RANSAC namespace, set them before calling the detection functions.
+#include <point_cloud.hh>
+#include <cloud_io.hh>
+#include <cloud_stream.hh>
+#include <normals.hh>
+#include <voxel_grid.hh>
+#include <synthetic_scene.hh>
+#include <color.hh>
+#include <ransac.hh>
+#include <organized.hh>
+#include <random.hh>
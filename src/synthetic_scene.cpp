@@ -0,0 +1,107 @@
+#include "synthetic_scene.hh"
+
+#include <parallel.hh>
+#include <random.hh>
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace tnp {
+
+namespace {
+
+struct Patch {
+    Eigen::Vector3f center, normal, u, v;
+};
+
+// Points drawn from one random stream, independent of the thread count
+constexpr size_t scene_block = 65536;
+
+Rng block_rng(uint64_t seed, uint64_t block)
+{
+    return Rng(mix_seed(seed, block));
+}
+
+Eigen::Vector3f random_direction(Rng &rng)
+{
+    Eigen::Vector3f d;
+    do
+    {
+        // drawn one by one, the evaluation order of arguments is unspecified
+        d.x() = rng.normal();
+        d.y() = rng.normal();
+        d.z() = rng.normal();
+    } while(d.squaredNorm() < 1e-12f);
+    return d.normalized();
+}
+
+} // namespace
+
+PointCloud generate_scene(const SceneOptions &options)
+{
+    const size_t n = options.points;
+    const size_t planes = static_cast<size_t>(std::max(0, options.planes));
+    const float ratio = planes == 0 ? 1.0f : std::min(1.0f, std::max(0.0f, options.outlier_ratio));
+    const size_t outliers = std::min(n, static_cast<size_t>(std::llround(static_cast<double>(n) * ratio)));
+    const size_t per_plane = planes == 0 ? 0 : (n - outliers) / planes;
+    // the remainder of the division goes to the outliers
+    const size_t on_planes = per_plane * planes;
+    const float half = 0.5f * options.extent;
+
+    // patches of half the cube side centered in its middle half, so they fit inside it
+    std::vector<Patch> patches(planes);
+    Rng rng = block_rng(options.seed, ~uint64_t(0));
+    for(Patch &patch : patches)
+    {
+        patch.center.x() = rng.uniform(-0.5f * half, 0.5f * half);
+        patch.center.y() = rng.uniform(-0.5f * half, 0.5f * half);
+        patch.center.z() = rng.uniform(-0.5f * half, 0.5f * half);
+        patch.normal = random_direction(rng);
+        patch.u = patch.normal.unitOrthogonal();
+        patch.v = patch.normal.cross(patch.u);
+    }
+
+    PointCloud cloud;
+    cloud.resize(n);
+    if(options.normals)
+    {
+        cloud.add_normals();
+    }
+    const size_t blocks = (n + scene_block - 1) / scene_block;
+    parallel_for(blocks, resolve_threads(options.threads), [&](size_t b)
+    {
+        Rng rng = block_rng(options.seed, b);
+        for(size_t i = b * scene_block; i < std::min(n, (b + 1) * scene_block); ++i)
+        {
+            if(i < on_planes)
+            {
+                const Patch &patch = patches[i / per_plane];
+                const float s = rng.uniform(-0.5f * half, 0.5f * half);
+                const float t = rng.uniform(-0.5f * half, 0.5f * half);
+                const float d = options.noise > 0.0f ? options.noise * rng.normal() : 0.0f;
+                cloud.set_point(i, patch.center + s * patch.u + t * patch.v + d * patch.normal);
+                if(options.normals)
+                {
+                    cloud.set_normal(i, patch.normal);
+                }
+            }
+            else
+            {
+                const float x = rng.uniform(-half, half);
+                const float y = rng.uniform(-half, half);
+                const float z = rng.uniform(-half, half);
+                cloud.set_point(i, Eigen::Vector3f(x, y, z));
+                if(options.normals)
+                {
+                    cloud.set_normal(i, random_direction(rng));
+                }
+            }
+        }
+    });
+    return cloud;
+}
+
+} // namespace tnp
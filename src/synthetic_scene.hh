@@ -0,0 +1,24 @@
+#pragma once
+#include <point_cloud.hh>
+
+#include <cstdint>
+
+namespace tnp {
+
+struct SceneOptions {
+    size_t points = 1000000; // total, outliers included
+    int planes = 5;
+    float noise = 0.01f; // standard deviation of the distance of plane points to their plane
+    float outlier_ratio = 0.1f; // fraction of the points drawn uniformly in the scene cube
+    float extent = 10.0f; // side of the scene cube, centered on the origin
+    bool normals = true; // plane points get the normal of their plane, outliers a random one
+    uint64_t seed = 1;
+    int threads = 0; // 0 or less means all hardware threads
+};
+
+// Square patches of random orientation inside the scene cube, sharing the points that are not
+// outliers equally, followed by the outliers. The points are drawn in fixed blocks of
+// their own random stream, so a seed gives the same cloud whatever the thread count.
+PointCloud generate_scene(const SceneOptions &options);
+
+} // namespace tnp
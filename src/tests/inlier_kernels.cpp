@@ -0,0 +1,143 @@
+// Checks that the scalar path and every SIMD kernel the CPU runs count the same inliers as the
+// original per-point test, on random clouds and on points lying exactly at the thresholds
+#include <inlier_kernel.hh>
+#include <random.hh>
+#include <ransac.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+    struct Cloud {
+        std::vector<float> x, y, z, nx, ny, nz;
+
+        explicit Cloud(size_t n) : x(n), y(n), z(n), nx(n), ny(n), nz(n) {}
+
+        RANSAC::PointsView view(bool with_normals) const {
+            RANSAC::PointsView pts{x.data(), y.data(), z.data()};
+            if (with_normals) {
+                pts.nx = nx.data();
+                pts.ny = ny.data();
+                pts.nz = nz.data();
+            }
+            pts.size = x.size();
+            return pts;
+        }
+    };
+
+    int failures = 0;
+
+    // Inliers among the first `size` points by point_to_plane_distance and calculate_alignement,
+    // the test RANSAC applied point by point before the kernels
+    size_t reference_count(const Cloud &c, size_t size, bool with_normals, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal,
+                           float dist_threshold, float align_threshold) {
+        size_t count = 0;
+        for (size_t i = 0; i < size; ++i) {
+            const Eigen::Vector3f point(c.x[i], c.y[i], c.z[i]);
+            bool inlier = RANSAC::point_to_plane_distance(point, centroid, normal) < dist_threshold;
+            if (with_normals) {
+                const Eigen::Vector3f point_normal(c.nx[i], c.ny[i], c.nz[i]);
+                inlier = inlier and RANSAC::calculate_alignement(point_normal, normal) >= align_threshold;
+            }
+            count += inlier;
+        }
+        return count;
+    }
+
+    // Compares the scalar path and every kernel with the original test, on every prefix length up to
+    // 40 to cover the tails
+    void check(const char *name, const Cloud &cloud, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal,
+               float dist_threshold, float align_threshold) {
+        for (const bool with_normals : {false, true}) {
+            const RANSAC::PointsView all = cloud.view(with_normals);
+            std::vector<size_t> sizes;
+            for (size_t size = 0; size <= std::min<size_t>(40, all.size); ++size) sizes.push_back(size);
+            sizes.push_back(all.size);
+            for (const size_t size : sizes) {
+                const RANSAC::PointsView pts = all.slice(0, size);
+                const size_t expected = reference_count(cloud, size, with_normals, centroid, normal, dist_threshold, align_threshold);
+                const size_t scalar = RANSAC::count_inliers_scalar(pts, centroid, normal, dist_threshold, align_threshold);
+                if (scalar != expected) {
+                    std::printf("FAIL %s: scalar path counts %zu of %zu points%s, original test %zu\n", name, scalar, pts.size,
+                                with_normals ? " with normals" : "", expected);
+                    ++failures;
+                }
+                for (const char *kernel : RANSAC::inlier_kernels()) {
+                    const size_t counted = RANSAC::count_inliers_with(kernel, pts, centroid, normal, dist_threshold, align_threshold);
+                    if (counted != expected) {
+                        std::printf("FAIL %s: %s kernel counts %zu of %zu points%s, original test %zu\n", name, kernel, counted, pts.size,
+                                    with_normals ? " with normals" : "", expected);
+                        ++failures;
+                    }
+                }
+            }
+        }
+    }
+
+    Eigen::Vector3f random_unit(tnp::Rng &rng) {
+        Eigen::Vector3f v;
+        do {
+            v = Eigen::Vector3f(rng.normal(), rng.normal(), rng.normal());
+        } while (v.squaredNorm() < 1e-6f);
+        return v.normalized();
+    }
+
+    // Distance and alignment of point i, by the original functions
+    float distance(const Cloud &c, size_t i, const Eigen::Vector3f &centroid, const Eigen::Vector3f &normal) {
+        return RANSAC::point_to_plane_distance(Eigen::Vector3f(c.x[i], c.y[i], c.z[i]), centroid, normal);
+    }
+    float alignment(const Cloud &c, size_t i, const Eigen::Vector3f &normal) {
+        return RANSAC::calculate_alignement(Eigen::Vector3f(c.nx[i], c.ny[i], c.nz[i]), normal);
+    }
+}
+
+int main() {
+    tnp::Rng rng(42);
+    const size_t n = 1003;
+
+    // random planes through random clouds, half the points close to the plane
+    for (int trial = 0; trial < 20; ++trial) {
+        Cloud cloud(n);
+        const Eigen::Vector3f centroid(rng.uniform(-5.0f, 5.0f), rng.uniform(-5.0f, 5.0f), rng.uniform(-5.0f, 5.0f));
+        const Eigen::Vector3f normal = random_unit(rng);
+        for (size_t i = 0; i < n; ++i) {
+            Eigen::Vector3f p(rng.uniform(-10.0f, 10.0f), rng.uniform(-10.0f, 10.0f), rng.uniform(-10.0f, 10.0f));
+            if (i % 2 == 0) p -= (normal.dot(p - centroid) + 0.5f * rng.normal()) * normal;
+            const Eigen::Vector3f pn = i % 3 == 0 ? normal : random_unit(rng);
+            cloud.x[i] = p.x(); cloud.y[i] = p.y(); cloud.z[i] = p.z();
+            cloud.nx[i] = pn.x(); cloud.ny[i] = pn.y(); cloud.nz[i] = pn.z();
+        }
+        check("random", cloud, centroid, normal, 0.3f, 0.9f);
+
+        // thresholds equal to the distance and alignment of some points, which must be excluded and included
+        const size_t probe = rng.below(n);
+        check("distance boundary", cloud, centroid, normal, distance(cloud, probe, centroid, normal), 0.9f);
+        check("alignment boundary", cloud, centroid, normal, 0.3f, alignment(cloud, probe, normal));
+    }
+
+    // axis aligned plane with points exactly at +-threshold and one ulp around it
+    {
+        const float threshold = 0.3f;
+        const float offsets[] = {threshold, -threshold, std::nextafter(threshold, 0.0f), std::nextafter(threshold, 1.0f),
+                                 -std::nextafter(threshold, 0.0f), 0.0f};
+        Cloud cloud(n);
+        for (size_t i = 0; i < n; ++i) {
+            cloud.x[i] = rng.uniform(-10.0f, 10.0f);
+            cloud.y[i] = rng.uniform(-10.0f, 10.0f);
+            cloud.z[i] = offsets[i % 6];
+            cloud.nz[i] = i % 4 == 0 ? 0.9f : 1.0f;
+        }
+        check("axis boundary", cloud, Eigen::Vector3f::Zero(), Eigen::Vector3f::UnitZ(), threshold, 0.9f);
+    }
+
+    if (failures > 0) {
+        std::printf("%d mismatches\n", failures);
+        return 1;
+    }
+    std::printf("scalar path and kernels match the original test:");
+    for (const char *kernel : RANSAC::inlier_kernels()) std::printf(" %s", kernel);
+    std::printf("\n");
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include <cloud_io.hh>
+#include <profile.hh>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+int main(int argc, char const *argv[]) {
+    if(argc <= 2) {
+        std::cout << "Error: missing argument" << std::endl;
+        std::cout << "Usage: cloud_convert <input>.{obj,ply,bpc} <output>.{obj,ply,bpc}" << std::endl;
+        return 0;
+    }
+    const std::string input = argv[1];
+    const std::string output = argv[2];
+
+    tnp::PointCloud cloud;
+    auto start = std::chrono::high_resolution_clock::now();
+    if(not tnp::load_cloud(input, cloud)) {
+        std::cout << "Failed to load input file '" << input << "'" << std::endl;
+        return 1;
+    }
+    auto loaded = std::chrono::high_resolution_clock::now();
+    if(not tnp::save_cloud(output, cloud)) {
+        std::cout << "Failed to save output file '" << output << "'" << std::endl;
+        return 1;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double> load_duration = loaded - start;
+    std::chrono::duration<double> save_duration = end - loaded;
+    std::cout << "Loading took " << load_duration.count() << " seconds, saving took " << save_duration.count() << " seconds." << std::endl;
+    tnp::profile::end_run(std::cout);
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include <ransac_core.hh>
+#include <inlier_kernel.hh>
+#include <parallel.hh>
+#include <profile.hh>
+#include <synthetic_scene.hh>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+    struct Stage {
+        std::string name;
+        double seconds; // best of the repetitions
+        double points; // points processed by one repetition
+    };
+
+    // Count with an optional K, M or G suffix
+    size_t parse_count(const std::string &text) {
+        size_t end = 0;
+        const double value = std::stod(text, &end);
+        double scale = 1.0;
+        if (end < text.size()) {
+            switch (text[end]) {
+                case 'k': case 'K': scale = 1e3; break;
+                case 'm': case 'M': scale = 1e6; break;
+                case 'g': case 'G': scale = 1e9; break;
+                default: throw std::invalid_argument(text);
+            }
+        }
+        return static_cast<size_t>(value * scale);
+    }
+
+    // Shortest time of `repeat` runs of the stage
+    double best_time(int repeat, const std::function<void()> &run) {
+        double best = 0.0;
+        for (int r = 0; r < repeat; ++r) {
+            auto start = std::chrono::high_resolution_clock::now();
+            run();
+            std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+            if (r == 0 or duration.count() < best) best = duration.count();
+        }
+        return best;
+    }
+
+    // Sends std::cout to stderr while alive, the progress lines of the library included, so the
+    // JSON is all that reaches stdout
+    class CoutToStderr {
+    public:
+        CoutToStderr() : stdout_(std::cout.rdbuf(std::cerr.rdbuf())) {}
+        ~CoutToStderr() { std::cout.rdbuf(stdout_); }
+        CoutToStderr(const CoutToStderr &) = delete;
+        CoutToStderr &operator=(const CoutToStderr &) = delete;
+
+        std::streambuf *stdout_buffer() const { return stdout_; }
+
+    private:
+        std::streambuf *stdout_;
+    };
+
+    void usage() {
+        std::cout << "Usage: ransac_bench [--points <count>[K|M|G]] [--planes <count>] [--noise <sigma>] [--outliers <ratio>]\n"
+                     "                    [--no-normals] [--format obj|ply|bpc] [--file <path>] [--threads <count>] [--seed <seed>]\n"
+                     "                    [--repeat <runs>] [--hypotheses <count>] [--voxel <size>] [--json <output>.json|-]" << std::endl;
+    }
+}
+
+int main(int argc, char const *argv[]) {
+    tnp::SceneOptions scene;
+    std::string format = "obj";
+    std::string file;
+    std::string json;
+    int repeat = 1;
+    size_t hypotheses = 256;
+    float voxel_size = 0.0f; // > 0 adds the extraction on a voxel grid of this size
+    try {
+        for (int a = 1; a < argc; ++a) {
+            const std::string arg = argv[a];
+            if (arg == "--no-normals") {
+                scene.normals = false;
+                continue;
+            }
+            if (arg == "--help" or a + 1 >= argc) {
+                usage();
+                return arg == "--help" ? 0 : 1;
+            }
+            const std::string value = argv[++a];
+            if (arg == "--points") scene.points = parse_count(value);
+            else if (arg == "--planes") scene.planes = std::stoi(value);
+            else if (arg == "--noise") scene.noise = std::stof(value);
+            else if (arg == "--outliers") scene.outlier_ratio = std::stof(value);
+            else if (arg == "--format") format = value;
+            else if (arg == "--file") file = value;
+            else if (arg == "--threads") scene.threads = std::stoi(value);
+            else if (arg == "--seed") scene.seed = std::stoull(value);
+            else if (arg == "--repeat") repeat = std::max(1, std::stoi(value));
+            else if (arg == "--hypotheses") hypotheses = parse_count(value);
+            else if (arg == "--voxel") voxel_size = std::stof(value);
+            else if (arg == "--json") json = value;
+            else {
+                std::cout << "Error: unknown option '" << arg << "'" << std::endl;
+                usage();
+                return 1;
+            }
+        }
+    } catch (const std::exception &) {
+        std::cout << "Error: invalid option value" << std::endl;
+        usage();
+        return 1;
+    }
+    if (format != "obj" and format != "ply" and format != "bpc") {
+        std::cout << "Error: unknown format '" << format << "'" << std::endl;
+        return 1;
+    }
+    if (scene.points < 3) {
+        std::cout << "Error: at least 3 points are needed" << std::endl;
+        return 1;
+    }
+    if (file.empty()) file = (std::filesystem::temp_directory_path() / ("ransac_bench." + format)).string();
+    std::unique_ptr<CoutToStderr> redirect;
+    if (json == "-") redirect = std::make_unique<CoutToStderr>();
+
+    // same parameters as improved_ransac, the threshold following the noise of the scene
+    RANSAC::iterations = 2000;
+    RANSAC::dist_threshold = std::max(3.0f * scene.noise, 1e-3f * scene.extent);
+    RANSAC::align_threshold = 0.8f;
+    RANSAC::pointsleft = std::min(0.95f, scene.outlier_ratio + 0.05f);
+    RANSAC::threads = scene.threads;
+    RANSAC::seed = scene.seed;
+    RANSAC::confidence = 0.99f;
+    RANSAC::sprt = true;
+
+    const double n = static_cast<double>(scene.points);
+    std::vector<Stage> stages;
+    tnp::PointCloud cloud;
+    stages.push_back({"generate", best_time(repeat, [&] { cloud = tnp::generate_scene(scene); }), n});
+
+    // the scene file read by the parse stage, the segmented cloud is written over it by the save stage
+    if (not tnp::save_cloud(file, cloud)) {
+        std::cout << "Error: could not write '" << file << "'" << std::endl;
+        return 1;
+    }
+    bool loaded = true;
+    stages.push_back({"parse", best_time(repeat, [&] { loaded = loaded and tnp::load_cloud(file, cloud); }), n});
+    if (not loaded) {
+        std::remove(file.c_str());
+        std::cout << "Error: could not read back '" << file << "'" << std::endl;
+        return 1;
+    }
+
+    // normals estimated on the positions only when the scene has its own
+    if (cloud.has_normals()) {
+        tnp::PointCloud positions = cloud;
+        positions.remove_normals();
+        stages.push_back({"normals", best_time(repeat, [&] { tnp::estimate_normals(positions, 16, scene.threads); }), n});
+    } else {
+        stages.push_back({"normals", best_time(repeat, [&] { tnp::estimate_normals(cloud, 16, scene.threads); }), n});
+    }
+
+    // planes through random point triples scored against the whole cloud, one hypothesis per task
+    std::vector<Eigen::Vector3f> centroids(hypotheses), normals(hypotheses);
+    tnp::Rng rng(scene.seed);
+    for (size_t h = 0; h < hypotheses; ++h) {
+        const std::array<size_t, 3> s = RANSAC::select_3_random_points(cloud.size(), rng);
+        RANSAC::estimate_plane(cloud.point(s[0]), cloud.point(s[1]), cloud.point(s[2]), centroids[h], normals[h]);
+    }
+    RANSAC::PointsView pts{cloud.x().data(), cloud.y().data(), cloud.z().data()};
+    if (cloud.has_normals()) {
+        pts.nx = cloud.nx().data();
+        pts.ny = cloud.ny().data();
+        pts.nz = cloud.nz().data();
+    }
+    pts.size = cloud.size();
+    std::vector<size_t> inliers(hypotheses);
+    stages.push_back({"scoring", best_time(repeat, [&] {
+        tnp::parallel_for(hypotheses, tnp::resolve_threads(scene.threads), [&](size_t h) {
+            inliers[h] = RANSAC::count_inliers(pts, centroids[h], normals[h], RANSAC::dist_threshold, RANSAC::align_threshold);
+        });
+    }), n * static_cast<double>(hypotheses)});
+
+    // the same extraction searching the voxel grid centroids, the full resolution one labels the points again
+    double voxel_seconds = 0.0;
+    if (voxel_size > 0.0f) {
+        RANSAC::voxel_size = voxel_size;
+        voxel_seconds = best_time(repeat, [&] { RANSAC::ransac_n_mult_planes(cloud); });
+        stages.push_back({"voxel", voxel_seconds, n});
+        RANSAC::voxel_size = 0.0f;
+    }
+    stages.push_back({"extraction", best_time(repeat, [&] { RANSAC::ransac_n_mult_planes(cloud); }), n});
+    const size_t planes_found = RANSAC::iterations_used.size();
+    const double extraction_seconds = stages.back().seconds;
+
+    bool saved = true;
+    stages.push_back({"save", best_time(repeat, [&] { saved = saved and tnp::save_cloud(file, cloud); }), n});
+    std::remove(file.c_str());
+    if (not saved) {
+        std::cout << "Error: could not write '" << file << "'" << std::endl;
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(12) << "stage" << std::right << std::setw(12) << "seconds" << std::setw(16) << "Mpoints/s" << std::endl;
+    for (const Stage &stage : stages) {
+        std::cout << std::left << std::setw(12) << stage.name << std::right << std::fixed
+                  << std::setw(12) << std::setprecision(4) << stage.seconds
+                  << std::setw(16) << std::setprecision(2) << stage.points / stage.seconds / 1e6 << std::endl;
+    }
+    std::cout << planes_found << " planes found out of " << scene.planes << ", " << RANSAC::inlier_kernel_name() << " kernel, "
+              << tnp::resolve_threads(scene.threads) << " threads" << std::endl;
+    if (voxel_size > 0.0f) {
+        std::cout << "Voxel grid of size " << std::defaultfloat << voxel_size << ": " << std::fixed << std::setprecision(2)
+                  << extraction_seconds / voxel_seconds << "x faster than the full resolution extraction" << std::endl;
+    }
+
+    if (not json.empty()) {
+        std::ofstream json_file;
+        std::ostream json_stdout(redirect ? redirect->stdout_buffer() : std::cout.rdbuf());
+        if (not redirect) {
+            json_file.open(json);
+            if (not json_file) {
+                std::cout << "Error: could not write '" << json << "'" << std::endl;
+                return 1;
+            }
+        }
+        std::ostream &out = redirect ? json_stdout : json_file;
+        out << std::defaultfloat << std::setprecision(9);
+        out << "{\n  \"scene\": {\"points\": " << scene.points << ", \"planes\": " << scene.planes << ", \"noise\": " << scene.noise
+            << ", \"outlier_ratio\": " << scene.outlier_ratio << ", \"normals\": " << (scene.normals ? "true" : "false")
+            << ", \"seed\": " << scene.seed << "},\n";
+        out << "  \"format\": \"" << format << "\",\n  \"threads\": " << tnp::resolve_threads(scene.threads)
+            << ",\n  \"kernel\": \"" << RANSAC::inlier_kernel_name() << "\",\n  \"repeat\": " << repeat
+            << ",\n  \"hypotheses\": " << hypotheses << ",\n  \"voxel_size\": " << voxel_size << ",\n  \"planes_found\": " << planes_found << ",\n  \"stages\": [\n";
+        for (size_t s = 0; s < stages.size(); ++s) {
+            out << "    {\"name\": \"" << stages[s].name << "\", \"seconds\": " << stages[s].seconds
+                << ", \"points\": " << stages[s].points << ", \"points_per_second\": " << stages[s].points / stages[s].seconds
+                << "}" << (s + 1 < stages.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}" << std::endl;
+    }
+    tnp::profile::end_run(std::cout);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include <Eigen/Core>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cloud_io.hh>
+#include <normals.hh>
+#include <profile.hh>
+#include "organized.hh"
+#include "ransac.hh"
+#include <chrono>
+
+int main(int argc, char const *argv[]) {
+    if(argc <= 3) {
+        std::cout << "Error: missing argument" << std::endl;
+        std::cout << "Usage: organized_planes <filename>.{obj,ply,bpc} <width> <height> [<output>.{obj,ply,bpc}]" << std::endl;
+        return 0;
+    }
+    const std::string filename = argv[1];
+    const size_t width = std::stoul(argv[2]);
+    const size_t height = std::stoul(argv[3]);
+    const std::string output = argc > 4 ? argv[4] : "organized_planes.ply";
+
+    tnp::PointCloud cloud;
+
+    if(not tnp::load_cloud(filename, cloud)) {
+        std::cout << "Failed to open input file '" << filename << "'" << std::endl;
+        return 1;
+    }
+
+    if (cloud.size() != width * height) {
+        std::cerr << "Error: " << cloud.size() << " points in file, " << width << " x " << height << " expected" << std::endl;
+        return 1;
+    }
+
+    // Organized cloud parameters
+    RANSAC::dist_threshold = 0.02f; // Distance threshold for the pixels grown onto a plane
+    RANSAC::align_threshold = 0.8f; // percentage alignement threshold
+    RANSAC::threads = 0; // worker threads, 0 = all hardware threads
+    RANSAC::organized_block = 10; // pixels on the side of the initial grid cells
+    RANSAC::organized_max_rms = 0.005f; // largest RMS distance to the plane of a cluster
+    RANSAC::organized_depth_noise = 0.0015f; // depth sensor noise, growing with the squared depth
+    RANSAC::organized_discontinuity = 0.02f; // relative depth jump between surfaces
+    RANSAC::organized_min_pixels = 800; // smallest plane kept
+
+    auto normals_start = std::chrono::high_resolution_clock::now();
+    if (not cloud.has_normals()) {
+        tnp::estimate_organized_normals(cloud, width, height, 4, RANSAC::threads);
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    const std::vector<RANSAC::OrganizedPlane> planes = RANSAC::organized_planes(cloud, width, height);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double> normals_duration = start - normals_start;
+    std::chrono::duration<double> duration = end - start;
+    std::cout << "Normals took " << normals_duration.count() * 1000.0 << " ms." << std::endl;
+    std::cout << "Plane extraction took " << duration.count() * 1000.0 << " ms." << std::endl;
+    for (size_t i = 0; i < planes.size(); ++i) {
+        std::cout << "Plane " << i << ": " << planes[i].pixels << " pixels, normal " << planes[i].normal.transpose()
+                  << ", rms " << planes[i].rms << std::endl;
+    }
+    tnp::save_cloud(output, cloud);
+    tnp::profile::end_run(std::cout);
+    return 0;
+}
@@ -1,44 +1,59 @@
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <obj.h>
+#include <cloud_io.hh>
+#include <profile.hh>
 #include "ransac.hh"
 #include <chrono>
 
 int main(int argc, char const *argv[]) {
-    if(argc <= 1) {
+    // options may come anywhere, the other arguments are positional
+    std::vector<std::string> args;
+    float confidence = 0.0f;
+    for (int a = 1; a < argc; ++a) {
+        const std::string arg = argv[a];
+        if (arg == "--confidence" and a + 1 < argc) confidence = std::stof(argv[++a]);
+        else args.push_back(arg);
+    }
+    if(args.empty()) {
         std::cout << "Error: missing argument" << std::endl;
-        std::cout << "Usage: ransac <filename>.obj" << std::endl;
+        std::cout << "Usage: ransac [--confidence <probability>] <filename>.{obj,ply,bpc} [<output>.{obj,ply,bpc}]" << std::endl;
         return 0;
     }
-    const std::string filename = argv[1];
+    const std::string filename = args[0];
+    const std::string output = args.size() > 1 ? args[1] : "unique_plan.obj";
 
-    std::vector<Eigen::Vector3f> points;
-    std::vector<Eigen::Vector3f> normals;
-    std::vector<Eigen::Vector3f> colors;
+    tnp::PointCloud cloud;
     
-    if(not tnp::load_obj(filename, points, normals, colors)) {
+    if(not tnp::load_cloud(filename, cloud)) {
         std::cout << "Failed to open input file '" << filename << "'" << std::endl;
         return 1;
     }
-    // if (normals.size() == 0){
+    // if (not cloud.has_normals()){
     //     std::cerr << "Error: no normals in file" << std::endl;
     //     return 1;
     // }
-    if (colors.size() == 0){
-        colors = std::vector<Eigen::Vector3f>(points.size(), Eigen::Vector3f(0.5f, 0.5f, 0.5f));
+    if (not cloud.has_colors()){
+        cloud.add_colors(Eigen::Vector3f(0.5f, 0.5f, 0.5f));
     }
     RANSAC::iterations = 100; // Number of iterations
     RANSAC::dist_threshold = 0.3f; // Distance threshold for inliers
+    RANSAC::confidence = confidence; // > 0 stops early once the plane is found with this probability
 
     auto start = std::chrono::high_resolution_clock::now();
-    RANSAC::simple_ransac(points, colors);
+    RANSAC::simple_ransac(cloud);
     auto end = std::chrono::high_resolution_clock::now();
 
     std::chrono::duration<double> duration = end - start;
     std::cout << "RANSAC took " << duration.count() << " seconds." << std::endl;
-    tnp::save_obj("unique_plan.obj", points, normals, colors);
+    for (size_t i = 0; i < RANSAC::iterations_used.size(); ++i) {
+        std::cout << "Plane " << i << ": " << RANSAC::iterations_used[i] << " iterations" << std::endl;
+    }
+    tnp::save_cloud(output, cloud);
     
+    tnp::profile::end_run(std::cout);
     return 0;
 }
\ No newline at end of file
@@ -1,50 +1,74 @@
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <obj.h>
+#include <cloud_io.hh>
+#include <profile.hh>
 #include "ransac.hh"
 #include <chrono>
 
 int main(int argc, char const *argv[]) {
-    if(argc <= 1) {
+    // options may come anywhere, the other arguments are positional
+    std::vector<std::string> args;
+    float confidence = 0.0f;
+    bool sprt = false;
+    for (int a = 1; a < argc; ++a) {
+        const std::string arg = argv[a];
+        if (arg == "--confidence" and a + 1 < argc) confidence = std::stof(argv[++a]);
+        else if (arg == "--sprt") sprt = true;
+        else args.push_back(arg);
+    }
+    if(args.empty()) {
         std::cout << "Error: missing argument" << std::endl;
-        std::cout << "Usage: ransac <filename>.obj" << std::endl;
+        std::cout << "Usage: ransac [--confidence <probability>] [--sprt] <filename>.{obj,ply,bpc} [<output>.{obj,ply,bpc}] [<voxel size>]" << std::endl;
         return 0;
     }
-    const std::string filename = argv[1];
+    const std::string filename = args[0];
+    const float voxel_size = args.size() > 2 ? std::stof(args[2]) : 0.0f;
+    const std::string output = args.size() > 1 ? args[1] : "mult_plan.obj";
 
-    std::vector<Eigen::Vector3f> points;
-    std::vector<Eigen::Vector3f> normals;
-    std::vector<Eigen::Vector3f> colors;
+    tnp::PointCloud cloud;
     
-    if(not tnp::load_obj(filename, points, normals, colors)) {
+    if(not tnp::load_cloud(filename, cloud)) {
         std::cout << "Failed to open input file '" << filename << "'" << std::endl;
         return 1;
     }
     
-    if (normals.size() == 0){
-        std::cerr << "Error: no normals in file" << std::endl;
-        return 1;
-    }
-
-    if (colors.size() == 0){
-        colors = std::vector<Eigen::Vector3f>(points.size(), Eigen::Vector3f(0.5f, 0.5f, 0.5f));
+    // ransac_multiple_planes tests the distances only, the normals are not estimated when missing
+    if (not cloud.has_colors()){
+        cloud.add_colors(Eigen::Vector3f(0.5f, 0.5f, 0.5f));
     }
     // RANSAC parameters
     RANSAC::iterations = 2000; // Number of iterations
     RANSAC::dist_threshold = 0.3f; // Distance threshold for inliers
     RANSAC::align_threshold = 0.8f; // percentage alignement threshold
     RANSAC::pointsleft = 0.15f; // percentage of points left after algorithm 
+    RANSAC::threads = 0; // worker threads, 0 = all hardware threads
+    RANSAC::confidence = confidence; // > 0 stops early once a plane is found with this probability
+    RANSAC::sprt = sprt; // reject bad hypotheses before scoring every point
+
+    if (voxel_size > 0.0f) {
+        RANSAC::voxel_size = voxel_size; // search on the voxel grid centroids
+    }
 
     auto start = std::chrono::high_resolution_clock::now();
-    RANSAC::ransac_multiple_planes(points, colors, normals);
+    RANSAC::ransac_multiple_planes(cloud);
     auto end = std::chrono::high_resolution_clock::now();
     
     std::chrono::duration<double> duration = end - start;
     std::cout << "RANSAC took " << duration.count() << " seconds." << std::endl;
+    if (voxel_size > 0.0f) {
+        std::cout << "Voxel grid of size " << voxel_size << ": " << cloud.size() << " -> " << RANSAC::downsampled_size
+                  << " points" << std::endl;
+    }
+    for (size_t i = 0; i < RANSAC::iterations_used.size(); ++i) {
+        std::cout << "Plane " << i << ": " << RANSAC::iterations_used[i] << " iterations" << std::endl;
+    }
     // Your code to handle the results...
-    tnp::save_obj("mult_plan.obj", points, normals, colors);
+    tnp::save_cloud(output, cloud);
 
+    tnp::profile::end_run(std::cout);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include <iostream>
+#include <profile.hh>
+#include "ransac.hh"
+#include <chrono>
+
+int main(int argc, char const *argv[]) {
+    if(argc <= 1) {
+        std::cout << "Error: missing argument" << std::endl;
+        std::cout << "Usage: streaming_ransac <filename>.{obj,bpc} [<output>.{ply,bpc}]" << std::endl;
+        return 0;
+    }
+    const std::string filename = argv[1];
+    const std::string output = argc > 2 ? argv[2] : "streaming_Ransac.ply";
+
+    // RANSAC parameters
+    RANSAC::iterations = 2000; // Number of iterations
+    RANSAC::dist_threshold = 0.3f; // Distance threshold for inliers
+    RANSAC::align_threshold = 0.8f; // percentage alignement threshold
+    RANSAC::pointsleft = 0.15f; // percentage of points left after algorithm 
+    RANSAC::threads = 0; // worker threads, 0 = all hardware threads
+    RANSAC::stream_chunk = 1 << 20; // points read at once
+    RANSAC::stream_sample = 1 << 20; // points kept in memory to draw hypotheses from
+    RANSAC::stream_candidates = 8; // hypotheses scored over the whole file for each plane
+
+    auto start = std::chrono::high_resolution_clock::now();
+    if(not RANSAC::streaming_ransac(filename, output)) {
+        std::cout << "Failed to process input file '" << filename << "'" << std::endl;
+        return 1;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double> duration = end - start;
+    std::cout << "Streaming RANSAC took " << duration.count() << " seconds." << std::endl;
+    for (size_t i = 0; i < RANSAC::iterations_used.size(); ++i) {
+        std::cout << "Plane " << i << ": " << RANSAC::iterations_used[i] << " iterations" << std::endl;
+    }
+    tnp::profile::end_run(std::cout);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include "voxel_grid.hh"
+
+#include <parallel.hh>
+#include <profile.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace tnp {
+
+namespace {
+
+struct VoxelKey {
+    int32_t x, y, z;
+    bool operator==(const VoxelKey &other) const { return x == other.x and y == other.y and z == other.z; }
+};
+
+struct VoxelHash {
+    size_t operator()(const VoxelKey &key) const
+    {
+        return static_cast<size_t>((uint64_t(uint32_t(key.x)) * 73856093u) ^ (uint64_t(uint32_t(key.y)) * 19349663u) ^ (uint64_t(uint32_t(key.z)) * 83492791u));
+    }
+};
+
+// Sums of the points falling in one cell
+struct Voxel {
+    Eigen::Vector3d point = Eigen::Vector3d::Zero();
+    Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+    size_t count = 0;
+};
+
+// Cells are partitioned in a fixed number of hash buckets, independent of the thread count
+constexpr size_t voxel_buckets = 256;
+
+} // namespace
+
+PointCloud voxel_downsample(const PointCloud &cloud, float voxel_size, int threads)
+{
+    TNP_SCOPE("voxel_downsample");
+    const size_t n = cloud.size();
+    const unsigned workers = resolve_threads(threads);
+    const size_t slices = std::max<size_t>(1, std::min<size_t>(workers, n));
+    const bool with_normals = cloud.has_normals();
+    const float scale = 1.0f / voxel_size;
+    const float *xs = cloud.x().data(), *ys = cloud.y().data(), *zs = cloud.z().data();
+    auto slice_begin = [&](size_t s) { return n * s / slices; };
+
+    // cell and bucket of every point, then a per slice histogram of the buckets
+    std::vector<VoxelKey> keys(n);
+    std::vector<uint16_t> buckets(n);
+    std::vector<std::vector<size_t>> histograms(slices, std::vector<size_t>(voxel_buckets, 0));
+    parallel_for(slices, workers, [&](size_t s)
+    {
+        for(size_t i = slice_begin(s); i < slice_begin(s + 1); ++i)
+        {
+            keys[i] = {static_cast<int32_t>(std::floor(xs[i] * scale)),
+                       static_cast<int32_t>(std::floor(ys[i] * scale)),
+                       static_cast<int32_t>(std::floor(zs[i] * scale))};
+            buckets[i] = static_cast<uint16_t>(VoxelHash()(keys[i]) % voxel_buckets);
+            ++histograms[s][buckets[i]];
+        }
+    });
+
+    // points grouped by bucket, in index order inside a bucket
+    std::vector<size_t> bucket_begin(voxel_buckets + 1, 0);
+    std::vector<std::vector<size_t>> cursors(slices, std::vector<size_t>(voxel_buckets));
+    for(size_t b = 0, offset = 0; b < voxel_buckets; ++b)
+    {
+        bucket_begin[b] = offset;
+        for(size_t s = 0; s < slices; ++s)
+        {
+            cursors[s][b] = offset;
+            offset += histograms[s][b];
+        }
+        bucket_begin[b + 1] = offset;
+    }
+    std::vector<size_t> order(n);
+    parallel_for(slices, workers, [&](size_t s)
+    {
+        for(size_t i = slice_begin(s); i < slice_begin(s + 1); ++i)
+            order[cursors[s][buckets[i]]++] = i;
+    });
+
+    // every bucket merges its points into cells in order of first appearance
+    std::vector<std::vector<Voxel>> voxels(voxel_buckets);
+    parallel_for(voxel_buckets, workers, [&](size_t b)
+    {
+        std::unordered_map<VoxelKey, size_t, VoxelHash> cells;
+        cells.reserve(bucket_begin[b + 1] - bucket_begin[b]);
+        for(size_t k = bucket_begin[b]; k < bucket_begin[b + 1]; ++k)
+        {
+            const size_t i = order[k];
+            const auto inserted = cells.emplace(keys[i], voxels[b].size());
+            if(inserted.second)
+                voxels[b].emplace_back();
+            Voxel &voxel = voxels[b][inserted.first->second];
+            voxel.point += cloud.point(i).cast<double>();
+            if(with_normals)
+            {
+                // normals are sign-ambiguous, they are flipped onto the first one before summing
+                const Eigen::Vector3d normal = cloud.normal(i).cast<double>();
+                voxel.normal += (voxel.count > 0 and voxel.normal.dot(normal) < 0.0) ? -normal : normal;
+            }
+            ++voxel.count;
+        }
+    });
+
+    std::vector<size_t> voxel_begin(voxel_buckets + 1, 0);
+    for(size_t b = 0; b < voxel_buckets; ++b)
+        voxel_begin[b + 1] = voxel_begin[b] + voxels[b].size();
+    PointCloud reduced;
+    if(with_normals)
+        reduced.add_normals();
+    reduced.resize(voxel_begin[voxel_buckets]);
+    parallel_for(voxel_buckets, workers, [&](size_t b)
+    {
+        for(size_t v = 0; v < voxels[b].size(); ++v)
+        {
+            const Voxel &voxel = voxels[b][v];
+            reduced.set_point(voxel_begin[b] + v, (voxel.point / static_cast<double>(voxel.count)).cast<float>());
+            if(with_normals)
+                reduced.set_normal(voxel_begin[b] + v, voxel.normal.normalized().cast<float>());
+        }
+    });
+    return reduced;
+}
+
+} // namespace tnp
@@ -0,0 +1,12 @@
+#pragma once
+#include <point_cloud.hh>
+
+namespace tnp {
+
+// Replaces the points of every occupied cell of a `voxel_size` grid by their centroid, normals are
+// averaged and renormalized. Cells are hashed, so the cost is O(N) whatever the extent of the
+// cloud, and the work is split over `threads` threads, 0 or less meaning all hardware threads.
+// The order of the output points only depends on the input, not on the thread count.
+PointCloud voxel_downsample(const PointCloud &cloud, float voxel_size, int threads = 0);
+
+} // namespace tnp